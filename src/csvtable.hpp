@@ -63,10 +63,36 @@ inline void skip_comments(std::istream& is)
 	return dictionary;
 }
 
+/** Interpolates the value_column at the key in key_column over rows accessed by get(row, column).
+ * The rows must be sorted by key_column and the columns must be in range. */
+template <typename Get>
+[[nodiscard]] double interpolate(size_t rows, Get get, const elem_t key, size_t key_column,
+								 size_t value_column)
+{
+	auto lo = size_t{0}, hi = rows;	 // binary search for the first row with key_column >= key
+	while (lo < hi) {
+		const auto mid = lo + (hi - lo) / 2;
+		if (get(mid, key_column) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == rows)
+		return get(rows - 1, value_column);	 // extrapolate with the last value
+	if (lo == 0)
+		return get(0, value_column);  // extrapolate with the first value
+	const auto x1 = get(lo - 1, key_column);
+	const auto x2 = get(lo, key_column);
+	const auto y1 = get(lo - 1, value_column);
+	if (x2 == x1)	// protect against div-by-zero
+		return y1;	// don't interpolate: pick the first
+	const auto y2 = get(lo, value_column);
+	return y1 + (y2 - y1) / (x2 - x1) * (key - x1);	 // linear interpolation
+}
+
 [[nodiscard]] double interpolate(const table_t& table, const elem_t key, int key_column,
 								 int value_column)
 {
-	using namespace std::string_literals;
 	if (key_column < 0)
 		throw std::runtime_error("negative key column");
 	if (key_column >= static_cast<int>(table.front().size()))
@@ -75,25 +101,9 @@ inline void skip_comments(std::istream& is)
 		throw std::runtime_error("negative value column");
 	if (value_column >= static_cast<int>(table.front().size()))
 		throw std::runtime_error("value column overflow");
-	auto it2 = std::lower_bound(std::begin(table), std::end(table), key,
-								[=](const row_t& row, const elem_t& key) {
-									return row[static_cast<size_t>(key_column)] < key;
-								});
-	if (it2 == std::end(table))
-		return table.back()[static_cast<size_t>(value_column)];	 // extrapolate with the last value
-	if (it2 == std::begin(table))
-		return table
-			.front()[static_cast<size_t>(value_column)];  // extrapolate with the first value
-	auto it1 = std::prev(it2);
-	auto& row1 = (*it1);
-	auto& row2 = (*it2);
-	auto& x1 = row1[static_cast<size_t>(key_column)];
-	auto& x2 = row2[static_cast<size_t>(key_column)];
-	auto& y1 = row1[static_cast<size_t>(value_column)];
-	if (x2 == x1)	// protect against div-by-zero
-		return y1;	// don't interpolate: pick the first
-	auto& y2 = row2[static_cast<size_t>(value_column)];
-	return y1 + (y2 - y1) / (x2 - x1) * (key - x1);	 // linear interpolation
+	return interpolate(
+		table.size(), [&table](size_t r, size_t c) { return table[r][c]; }, key,
+		static_cast<size_t>(key_column), static_cast<size_t>(value_column));
 }
 
 std::ostream& table_write_csv(std::ostream& os, const table_t& table, const char sep = ',')
@@ -55,6 +55,8 @@ FILE* open_error_file()
 void log_error(const char* function, const char* path, int line, const char* format, ...)
 {
 	auto file = open_error_file();
+	if (file == nullptr)
+		return;
 	const auto time = std::chrono::system_clock::now().time_since_epoch();
 	const auto sec = std::chrono::duration_cast<std::chrono::seconds>(time);
 	const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(time - sec);
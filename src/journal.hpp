@@ -0,0 +1,190 @@
+/**
+ * Undo journal of table modifications for checkpoints and rollbacks.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#ifndef _JOURNAL_HPP_
+#define _JOURNAL_HPP_
+
+#include "storage.hpp"
+
+#include <algorithm>  // find_if, max
+#include <limits>	  // numeric_limits
+#include <vector>
+
+/** Undo journal: records the overwritten cells and shapes while at least one checkpoint is open.
+ * Checkpoints are nested: a token denotes a position in the journal and rolling back to it undoes
+ * all later modifications in reverse order, thus the cost is proportional to the number of changes.
+ * Tokens are not reused, thus a token of a discarded checkpoint is rejected rather than taken for
+ * a newer checkpoint at the same depth.
+ */
+class journal_t
+{
+	/** Overwritten cell, or a reference to shapes[col] if row is negative */
+	struct undo_t
+	{
+		int row;
+		int col;
+		elem_t value;
+	};
+	/** Table shape and the cells removed by a reshaping operation (resize or clear) */
+	struct shape_t
+	{
+		size_t rows;
+		size_t cols;
+		std::vector<size_t> widths;	 // the width of each row if the table is not rectangular
+		elem_t fill;				 // the value of cells which are not stored
+		bool sparse;
+		std::vector<undo_t> removed;  // the (stored) cells that did not fit into the new shape
+	};
+	/** Open checkpoint: the log position and the token given out for it */
+	struct mark_t
+	{
+		size_t pos;
+		int token;
+	};
+	std::vector<undo_t> log;
+	std::vector<shape_t> shapes;
+	std::vector<mark_t> marks;	// open checkpoints, the innermost last
+	int next_token = 0;
+	size_t shape_bytes = 0;		// bytes held by the widths and removed cells of the shapes
+
+public:
+	/** The number of bytes allocated by recording a write: the log grows only when it is full */
+	size_t record_write_bytes() const { return grow_bytes(log); }
+
+	/** The number of bytes allocated by recording the shape before reshaping */
+	size_t record_shape_bytes(const storage_t& table, size_t rows, size_t cols) const
+	{
+		const auto widths = table.rectangular() ? size_t{0} : table.rows() * sizeof(size_t);
+		return grow_bytes(log) + grow_bytes(shapes) + widths +
+			   table.count_outside(rows, cols) * sizeof(undo_t);
+	}
+
+	/** The number of bytes held by the journal */
+	size_t bytes() const
+	{
+		return log.capacity() * sizeof(undo_t) + shapes.capacity() * sizeof(shape_t) +
+			   marks.capacity() * sizeof(mark_t) + shape_bytes;
+	}
+
+	/** Whether modifications need to be recorded */
+	bool active() const { return !marks.empty(); }
+
+	/** Opens a new (nested) checkpoint and returns its token */
+	int checkpoint()
+	{
+		marks.push_back({log.size(), next_token});
+		next_token = (next_token < std::numeric_limits<int>::max()) ? next_token + 1 : 0;
+		return marks.back().token;
+	}
+
+	/** Records the value of the cell before it is overwritten */
+	void record_write(int row, int col, elem_t old_value)
+	{
+		grow(log);
+		log.push_back({row, col, old_value});
+	}
+
+	/** Records the shape of the table before it is reshaped into rows x cols */
+	void record_shape(const storage_t& table, size_t rows, size_t cols)
+	{
+		grow(log);
+		grow(shapes);
+		auto& shape = shapes.emplace_back();
+		shape.rows = table.rows();
+		shape.cols = (shape.rows > 0) ? table.cols(0) : 0;
+		if (!table.rectangular()) {
+			shape.widths.reserve(shape.rows);
+			for (auto r = size_t{0}; r < shape.rows; ++r)
+				shape.widths.push_back(table.cols(r));
+		}
+		shape.fill = table.fill();
+		shape.sparse = table.is_sparse();
+		shape.removed.reserve(table.count_outside(rows, cols));
+		table.for_each_outside(rows, cols, [&shape](size_t r, size_t c, elem_t v) {
+			shape.removed.push_back({static_cast<int>(r), static_cast<int>(c), v});
+		});
+		shape_bytes += held(shape);
+		log.push_back({-1, static_cast<int>(shapes.size()) - 1, elem_t{}});
+	}
+
+	/** Undoes all the modifications since the checkpoint, which stays open for further rollbacks.
+	 * @return false if the token is not open */
+	bool rollback(storage_t& table, int token)
+	{
+		const auto it = find(token);
+		if (it == marks.end())
+			return false;
+		const auto mark = it->pos;
+		marks.erase(it + 1, marks.end());  // discard nested checkpoints
+		while (log.size() > mark) {
+			const auto& undo = log.back();
+			if (undo.row >= 0) {
+				table.set(static_cast<size_t>(undo.row), static_cast<size_t>(undo.col), undo.value);
+			} else {
+				restore(table, shapes.back());
+				shape_bytes -= held(shapes.back());
+				shapes.pop_back();
+			}
+			log.pop_back();
+		}
+		return true;
+	}
+
+	/** Closes the checkpoint and the nested ones without undoing the modifications.
+	 * @return false if the token is not open */
+	bool release(int token)
+	{
+		const auto it = find(token);
+		if (it == marks.end())
+			return false;
+		marks.erase(it, marks.end());
+		if (marks.empty()) {  // nobody can roll back anymore
+			log.clear();
+			log.shrink_to_fit();
+			shapes.clear();
+			shapes.shrink_to_fit();
+			marks.shrink_to_fit();
+			shape_bytes = 0;
+		}
+		return true;
+	}
+
+private:
+	/** The capacity of a full vector after growing, doubled as by push_back but made explicit,
+	 * so that the memory limit can be checked before the allocation */
+	static size_t grown(size_t capacity) { return std::max(capacity * 2, size_t{16}); }
+
+	template <typename T>
+	static size_t grow_bytes(const std::vector<T>& items)
+	{
+		return (items.size() < items.capacity()) ? 0 : grown(items.capacity()) * sizeof(T);
+	}
+
+	template <typename T>
+	static void grow(std::vector<T>& items)
+	{
+		if (items.size() == items.capacity())
+			items.reserve(grown(items.capacity()));
+	}
+
+	std::vector<mark_t>::iterator find(int token)
+	{
+		return std::find_if(marks.begin(), marks.end(),
+							[token](const mark_t& mark) { return mark.token == token; });
+	}
+
+	static size_t held(const shape_t& shape)
+	{
+		return shape.widths.capacity() * sizeof(size_t) + shape.removed.capacity() * sizeof(undo_t);
+	}
+
+	static void restore(storage_t& table, const shape_t& shape)
+	{
+		table.restore(shape.rows, shape.cols, shape.widths, shape.fill, shape.sparse);
+		for (const auto& cell : shape.removed)
+			table.set(static_cast<size_t>(cell.row), static_cast<size_t>(cell.col), cell.value);
+	}
+};
+
+#endif /* _JOURNAL_HPP_ */
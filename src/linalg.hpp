@@ -0,0 +1,93 @@
+/**
+ * Dense linear algebra kernels over table rows.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#ifndef _LINALG_HPP_
+#define _LINALG_HPP_
+
+#include <algorithm>  // min
+#include <cmath>	  // tanh
+#include <cstddef>	  // size_t
+#include <iterator>	  // data
+
+/** Activation functions applied to the layer outputs */
+enum activation_t : int { ACT_IDENTITY = 0, ACT_RELU = 1, ACT_TANH = 2 };
+
+/** The number of vector elements processed per block: keeps the block of x in L1 cache while
+ * it is multiplied with all the rows */
+constexpr auto matvec_block = size_t{2048};
+
+/**
+ * Adds the products of columns [begin, end) of rows r..r+3 with x to y[r..r+3].
+ * Each row has four independent accumulators over consecutive columns, which the compiler maps to
+ * SIMD lanes without reassociating the sums, and every loaded element of x is used four times.
+ */
+inline void matvec_rows4(const double* const a[4], const double* x, size_t begin, size_t end,
+						 double* y)
+{
+	double acc[4][4] = {};
+	auto c = begin;
+	for (; c + 4 <= end; c += 4)
+		for (auto k = 0; k < 4; ++k)
+			for (auto j = 0; j < 4; ++j)
+				acc[k][j] += a[k][c + j] * x[c + j];
+	for (auto k = 0; k < 4; ++k) {
+		auto sum = (acc[k][0] + acc[k][1]) + (acc[k][2] + acc[k][3]);
+		for (auto i = c; i < end; ++i)
+			sum += a[k][i] * x[i];
+		y[k] += sum;
+	}
+}
+
+/** Adds the product of columns [begin, end) of a row with x to y, see matvec_rows4 */
+inline void matvec_row(const double* a, const double* x, size_t begin, size_t end, double& y)
+{
+	double acc[4] = {};
+	auto c = begin;
+	for (; c + 4 <= end; c += 4)
+		for (auto j = 0; j < 4; ++j)
+			acc[j] += a[c + j] * x[c + j];
+	auto sum = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+	for (; c < end; ++c)
+		sum += a[c] * x[c];
+	y += sum;
+}
+
+/**
+ * Computes y = A * x, where A consists of the first n columns of rows [0, m).
+ * @param rows indexable rows of at least n contiguous elements (e.g. table_t)
+ */
+template <typename Rows>
+void matvec(const Rows& rows, size_t m, const double* x, size_t n, double* y)
+{
+	std::fill(y, y + m, 0.0);
+	for (auto begin = size_t{0}; begin < n; begin += matvec_block) {
+		const auto end = std::min(n, begin + matvec_block);
+		auto r = size_t{0};
+		for (; r + 4 <= m; r += 4) {
+			const double* a[4] = {std::data(rows[r]), std::data(rows[r + 1]),
+								  std::data(rows[r + 2]), std::data(rows[r + 3])};
+			matvec_rows4(a, x, begin, end, y + r);
+		}
+		for (; r < m; ++r)
+			matvec_row(std::data(rows[r]), x, begin, end, y[r]);
+	}
+}
+
+/** Applies the activation function to each of n elements */
+inline void activate(activation_t activation, double* y, size_t n)
+{
+	switch (activation) {
+	case ACT_IDENTITY: break;
+	case ACT_RELU:
+		for (auto i = size_t{0}; i < n; ++i)
+			y[i] = std::max(y[i], 0.0);
+		break;
+	case ACT_TANH:
+		for (auto i = size_t{0}; i < n; ++i)
+			y[i] = std::tanh(y[i]);
+		break;
+	}
+}
+
+#endif /* _LINALG_HPP_ */
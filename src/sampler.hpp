@@ -0,0 +1,154 @@
+/**
+ * Sampling from empirical distributions given by (value, weight) pairs.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#ifndef _SAMPLER_HPP_
+#define _SAMPLER_HPP_
+
+#include "csvtable.hpp"
+
+#include <cmath>	// isfinite
+#include <cstdint>
+#include <utility>	// pair
+#include <vector>
+
+/** Precomputed sampler of an empirical distribution:
+ * - Walker's alias table for drawing one of the values in O(1).
+ * - Cumulative distribution with a guide table for drawing from the piecewise-linear CDF
+ *   through the values in expected O(1).
+ */
+class sampler_t
+{
+	/** Alias table bin: keep the value with the threshold probability, otherwise take the alias */
+	struct bin_t
+	{
+		double threshold;
+		elem_t value;
+		elem_t alias;
+	};
+	std::vector<bin_t> bins;
+	std::vector<elem_t> values;			// sorted values
+	std::vector<double> cdf;			// cumulative weights normalized to 1
+	std::vector<std::uint32_t> guide;	// guide[k] is the first i such that cdf[i] >= k/size
+
+public:
+	using point_t = std::pair<elem_t, double>;	// value and weight
+
+	/** Precomputes the tables, returns false if the weights are negative or add up to zero */
+	bool build(std::vector<point_t> points)
+	{
+		auto total = 0.0;
+		for (const auto& [value, weight] : points) {
+			if (!(weight >= 0) || !std::isfinite(weight) || !std::isfinite(value))
+				return false;
+			total += weight;
+		}
+		if (!(total > 0) || !std::isfinite(total))
+			return false;
+		std::sort(points.begin(), points.end());
+		const auto n = points.size();
+		build_alias(points, total);
+		values.resize(n);
+		cdf.resize(n);
+		auto sum = 0.0;
+		for (auto i = size_t{0}; i < n; ++i) {
+			values[i] = points[i].first;
+			sum += points[i].second;
+			cdf[i] = sum / total;
+		}
+		cdf.back() = 1.0;  // protect against rounding
+		guide.resize(n);
+		auto i = std::uint32_t{0};
+		for (auto k = size_t{0}; k < n; ++k) {
+			const auto u = static_cast<double>(k) / static_cast<double>(n);
+			while (cdf[i] < u)
+				++i;
+			guide[k] = i;
+		}
+		return true;
+	}
+
+	/** Draws a value with the probability proportional to its weight.
+	 * @param u1 uniformly distributed in [0,1) to pick a bin
+	 * @param u2 uniformly distributed in [0,1) to choose between the value and its alias */
+	elem_t sample(double u1, double u2) const
+	{
+		const auto& bin = bins[index(u1, bins.size())];
+		return (u2 < bin.threshold) ? bin.value : bin.alias;
+	}
+
+	/** Draws a value from the piecewise-linear CDF through the cumulative weights of the values.
+	 * The weight of the smallest value is its point mass.
+	 * @param u uniformly distributed in [0,1] */
+	elem_t sample_continuous(double u) const
+	{
+		const auto n = guide.size();
+		if (!(u < 1.0)) [[unlikely]]
+			return values.back();
+		auto i = static_cast<size_t>(guide[index(u, n)]);
+		while (cdf[i] < u && i + 1 < n)
+			++i;
+		if (i == 0 || cdf[i - 1] >= u)
+			return values[i];
+		const auto t = (u - cdf[i - 1]) / (cdf[i] - cdf[i - 1]);
+		return values[i - 1] + t * (values[i] - values[i - 1]);
+	}
+
+	/** The peak number of bytes allocated while building a sampler of n points:
+	 * the points, the temporaries of the alias construction and the resulting tables */
+	static double build_bytes(size_t n)
+	{
+		constexpr auto per_point = sizeof(point_t) + sizeof(double) + 2 * sizeof(size_t) +
+								   sizeof(bin_t) + sizeof(elem_t) + sizeof(double) +
+								   sizeof(std::uint32_t);
+		return static_cast<double>(n) * per_point;
+	}
+
+	/** The number of bytes held by the sampler */
+	size_t bytes() const
+	{
+		return bins.capacity() * sizeof(bin_t) + values.capacity() * sizeof(elem_t) +
+			   cdf.capacity() * sizeof(double) + guide.capacity() * sizeof(std::uint32_t);
+	}
+
+private:
+	/** Maps u from [0,1) to [0,n) while keeping the values outside in range (including NaN) */
+	static size_t index(double u, size_t n)
+	{
+		const auto x = u * static_cast<double>(n);
+		if (x > 0) [[likely]]
+			return (x < static_cast<double>(n)) ? static_cast<size_t>(x) : n - 1;
+		return 0;
+	}
+
+	/** Vose's construction of the alias table */
+	void build_alias(const std::vector<point_t>& points, double total)
+	{
+		const auto n = points.size();
+		auto scaled = std::vector<double>(n);
+		auto small = std::vector<size_t>{};
+		auto large = std::vector<size_t>{};
+		for (auto i = size_t{0}; i < n; ++i) {
+			scaled[i] = points[i].second * static_cast<double>(n) / total;
+			(scaled[i] < 1.0 ? small : large).push_back(i);
+		}
+		bins.resize(n);
+		while (!small.empty() && !large.empty()) {
+			const auto s = small.back();
+			small.pop_back();
+			const auto l = large.back();
+			bins[s] = {scaled[s], points[s].first, points[l].first};
+			scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+			if (scaled[l] < 1.0) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+		for (auto i : large)  // the rest are full up to rounding errors
+			bins[i] = {1.0, points[i].first, points[i].first};
+		for (auto i : small)
+			bins[i] = {1.0, points[i].first, points[i].first};
+	}
+};
+
+#endif /* _SAMPLER_HPP_ */
@@ -0,0 +1,344 @@
+/**
+ * Table storage: dense rows of cells or sparse map of cells different from the fill value.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#ifndef _STORAGE_HPP_
+#define _STORAGE_HPP_
+
+#include "csvtable.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+/** Rectangular table of rows x cols cells, where only the cells different from fill are stored */
+class sparse_table_t
+{
+	size_t n_rows = 0;
+	size_t n_cols = 0;
+	elem_t fill_value = 0;
+	std::unordered_map<std::uint64_t, elem_t> cells;
+
+	static std::uint64_t key(size_t row, size_t col)
+	{
+		return (static_cast<std::uint64_t>(row) << 32) | static_cast<std::uint64_t>(col);
+	}
+	static size_t key_row(std::uint64_t key) { return static_cast<size_t>(key >> 32); }
+	static size_t key_col(std::uint64_t key) { return static_cast<size_t>(key & 0xFFFFFFFFu); }
+
+public:
+	/** The approximate number of bytes per stored cell: the map node with the key and the value */
+	static constexpr auto node_bytes = sizeof(std::pair<std::uint64_t, elem_t>) + sizeof(void*);
+
+	sparse_table_t(size_t rows, size_t cols, elem_t fill):
+		n_rows{rows}, n_cols{cols}, fill_value{fill}
+	{}
+	size_t rows() const { return n_rows; }
+	size_t cols() const { return n_cols; }
+	elem_t fill() const { return fill_value; }
+	/** The number of stored cells */
+	size_t stored() const { return cells.size(); }
+	/** The approximate number of bytes held by the buckets and the stored cells */
+	size_t bytes() const
+	{
+		return cells.bucket_count() * sizeof(void*) + cells.size() * node_bytes;
+	}
+
+	/** Reads the cell, the row and column must be in range */
+	elem_t get(size_t row, size_t col) const
+	{
+		const auto it = cells.find(key(row, col));
+		return (it == cells.end()) ? fill_value : it->second;
+	}
+
+	/** The number of bytes allocated by storing one more cell: its node and the new buckets
+	 * if the map is full */
+	size_t set_bytes() const { return node_bytes + (full() ? grown() * sizeof(void*) : 0); }
+
+	/** Writes the cell, the row and column must be in range */
+	void set(size_t row, size_t col, elem_t value)
+	{
+		if (value == fill_value) {
+			cells.erase(key(row, col));
+			return;
+		}
+		if (full())
+			cells.rehash(grown());	// grows as insert would, but by the number set_bytes expects
+		cells.insert_or_assign(key(row, col), value);
+	}
+
+	/** Calls fn(row, col, value) for each stored cell in unspecified order */
+	template <typename Fn>
+	void for_each(Fn fn) const
+	{
+		for (const auto& [k, value] : cells)
+			fn(key_row(k), key_col(k), value);
+	}
+
+	/** Changes the dimensions: the cells outside are dropped, the new ones have the fill value */
+	void resize(size_t rows, size_t cols)
+	{
+		if (rows < n_rows || cols < n_cols) {
+			for (auto it = cells.begin(); it != cells.end();) {
+				if (key_row(it->first) >= rows || key_col(it->first) >= cols)
+					it = cells.erase(it);
+				else
+					++it;
+			}
+		}
+		n_rows = rows;
+		n_cols = cols;
+	}
+
+	table_t to_dense() const
+	{
+		auto table = table_t(n_rows, row_t(n_cols, fill_value));
+		for_each([&table](size_t r, size_t c, elem_t v) { table[r][c] = v; });
+		return table;
+	}
+
+	/** Writes all the cells (including the fill values) in rows */
+	std::ostream& write_csv(std::ostream& os, const char sep = ',') const
+	{
+		auto keys = std::vector<std::uint64_t>{};
+		keys.reserve(cells.size());
+		for (const auto& [k, value] : cells)
+			keys.push_back(k);
+		std::sort(keys.begin(), keys.end());  // row-major order
+		auto next = keys.begin();
+		for (auto r = size_t{0}; r < n_rows; ++r) {
+			for (auto c = size_t{0}; c < n_cols; ++c) {
+				if (c > 0)
+					os << sep;
+				if (next != keys.end() && *next == key(r, c))
+					os << cells.at(*next++);
+				else
+					os << fill_value;
+			}
+			os << '\n';
+		}
+		return os;
+	}
+
+private:
+	/** Whether storing one more cell makes the map rehash into more buckets */
+	bool full() const
+	{
+		return static_cast<float>(cells.size() + 1) >
+			   cells.max_load_factor() * static_cast<float>(cells.bucket_count());
+	}
+	/** The number of buckets after growing */
+	size_t grown() const { return std::max(cells.bucket_count() * 2, size_t{16}); }
+};
+
+/** Table cells stored either densely in rows (possibly of different widths when read from CSV),
+ * or sparsely in a map (for large tables where most cells keep the initial value). */
+class storage_t
+{
+	table_t dense;
+	std::optional<sparse_table_t> sparse;  // dense is empty when sparse is set
+	size_t dense_size = 0;				   // bytes held by the dense rows
+
+public:
+	/** Tables with at least this many cells are created sparse */
+	static constexpr auto sparse_min_cells = size_t{1} << 20;
+
+	storage_t() = default;
+	explicit storage_t(table_t&& table): dense{std::move(table)} { count_dense(); }
+	storage_t(size_t rows, size_t cols, elem_t value, bool is_sparse)
+	{
+		if (is_sparse)
+			sparse.emplace(rows, cols, value);
+		else
+			dense = table_t(rows, row_t(cols, value));
+		count_dense();
+	}
+
+	/** The number of bytes needed for a dense table of rows x cols (as double to avoid overflow) */
+	static double dense_bytes(size_t rows, size_t cols)
+	{
+		return static_cast<double>(rows) *
+			   (sizeof(row_t) + static_cast<double>(cols) * sizeof(elem_t));
+	}
+	/** The number of bytes held by the cells (approximately for sparse tables).
+	 * The dense rows are counted when reshaped, thus writes and reads do not pay for accounting. */
+	size_t bytes() const { return sparse ? sparse->bytes() : dense_size; }
+
+	bool is_sparse() const { return sparse.has_value(); }
+	/** Dense rows, or nullptr if the table is sparse */
+	table_t* rows_data() { return sparse ? nullptr : &dense; }
+	const table_t* rows_data() const { return sparse ? nullptr : &dense; }
+	const sparse_table_t* sparse_data() const { return sparse ? &*sparse : nullptr; }
+
+	size_t rows() const { return sparse ? sparse->rows() : dense.size(); }
+	/** The number of columns in the given row */
+	size_t cols(size_t row) const { return sparse ? sparse->cols() : dense[row].size(); }
+	/** The value of cells which are not stored (the default value for dense tables) */
+	elem_t fill() const { return sparse ? sparse->fill() : elem_t{}; }
+
+	/** Reads the cell, the row and column must be in range */
+	elem_t get(size_t row, size_t col) const
+	{
+		return sparse ? sparse->get(row, col) : dense[row][col];
+	}
+
+	/** Writes the cell, the row and column must be in range */
+	void set(size_t row, size_t col, elem_t value)
+	{
+		if (sparse)
+			sparse->set(row, col, value);
+		else
+			dense[row][col] = value;
+	}
+
+	/** Whether all rows have the same number of columns */
+	bool rectangular() const
+	{
+		if (sparse || dense.empty())
+			return true;
+		const auto width = dense.front().size();
+		return std::all_of(dense.begin(), dense.end(),
+						   [width](const row_t& row) { return row.size() == width; });
+	}
+
+	/** Calls fn(row, col, value) for each cell that does not fit into rows x cols.
+	 * Sparse tables enumerate only the stored cells. */
+	template <typename Fn>
+	void for_each_outside(size_t rows, size_t cols, Fn fn) const
+	{
+		if (sparse) {
+			sparse->for_each([&](size_t r, size_t c, elem_t v) {
+				if (r >= rows || c >= cols)
+					fn(r, c, v);
+			});
+			return;
+		}
+		for (auto r = size_t{0}; r < dense.size(); ++r) {
+			const auto& row = dense[r];
+			for (auto c = (r < rows) ? std::min(cols, row.size()) : size_t{0}; c < row.size(); ++c)
+				fn(r, c, row[c]);
+		}
+	}
+
+	/** The number of cells (stored cells if sparse) outside of rows x cols */
+	size_t count_outside(size_t rows, size_t cols) const
+	{
+		auto count = size_t{0};
+		if (sparse) {
+			for_each_outside(rows, cols, [&count](size_t, size_t, elem_t) { ++count; });
+			return count;
+		}
+		for (auto r = size_t{0}; r < dense.size(); ++r) {
+			const auto width = dense[r].size();
+			count += width - ((r < rows) ? std::min(cols, width) : size_t{0});
+		}
+		return count;
+	}
+
+	/** Resizes the table to a rectangle, the new cells get the value.
+	 * A sparse table becomes dense if the value differs from its fill value. */
+	void resize(size_t rows, size_t cols, elem_t value)
+	{
+		if (sparse) {
+			if (value == sparse->fill()) {
+				sparse->resize(rows, cols);
+				return;
+			}
+			// build the dense table at the new size, copying only the stored cells inside it
+			auto table = table_t(rows, row_t(cols, value));
+			const auto old_cols = std::min(cols, sparse->cols());
+			for (auto r = size_t{0}; r < std::min(rows, sparse->rows()); ++r)
+				std::fill_n(table[r].begin(), old_cols, sparse->fill());
+			sparse->for_each([&table, rows, cols](size_t r, size_t c, elem_t v) {
+				if (r < rows && c < cols)
+					table[r][c] = v;
+			});
+			sparse.reset();
+			dense = std::move(table);
+			count_dense();
+			return;
+		}
+		dense.resize(rows);
+		for (auto& row : dense)
+			row.resize(cols, value);
+		count_dense();
+	}
+
+	/** Restores the shape recorded before reshaping, the new cells get the fill value.
+	 * widths specifies the width of each row, or is empty for rectangular rows x cols.
+	 * A table which was sparse becomes sparse again without expanding the old shape densely:
+	 * only the dense cells inside the old shape which differ from the fill value are stored. */
+	void restore(size_t rows, size_t cols, const std::vector<size_t>& widths, elem_t fill,
+				 bool was_sparse)
+	{
+		if (sparse) {
+			sparse->resize(rows, cols);
+			return;
+		}
+		if (was_sparse) {
+			auto cells = sparse_table_t{rows, cols, fill};
+			for (auto r = size_t{0}; r < std::min(rows, dense.size()); ++r) {
+				const auto& row = dense[r];
+				for (auto c = size_t{0}; c < std::min(cols, row.size()); ++c)
+					if (row[c] != fill)
+						cells.set(r, c, row[c]);
+			}
+			sparse.emplace(std::move(cells));
+			dense = table_t{};
+			count_dense();
+			return;
+		}
+		dense.resize(rows);
+		for (auto r = size_t{0}; r < rows; ++r)
+			dense[r].resize(widths.empty() ? cols : widths[r], fill);
+		count_dense();
+	}
+
+	/** Converts a sparse table to dense when dense storage becomes more compact.
+	 * A stored cell takes several times more memory than a dense one, hence the ratio of 1/4. */
+	void adapt()
+	{
+		if (sparse && dense_at(sparse->stored()))
+			make_dense();
+	}
+
+	/** Whether adapt() converts the sparse table to dense when it stores the number of cells */
+	bool dense_at(size_t stored) const
+	{
+		return sparse && static_cast<std::uint64_t>(stored) * 4 >
+							 static_cast<std::uint64_t>(sparse->rows()) * sparse->cols();
+	}
+
+	void clear()
+	{
+		sparse.reset();
+		dense.clear();
+		dense.shrink_to_fit();
+		dense_size = 0;
+	}
+
+	std::ostream& write_csv(std::ostream& os, const char sep = ',') const
+	{
+		if (sparse)
+			return sparse->write_csv(os, sep);
+		return table_write_csv(os, dense, sep);
+	}
+
+private:
+	void make_dense()
+	{
+		dense = sparse->to_dense();
+		sparse.reset();
+		count_dense();
+	}
+
+	void count_dense()
+	{
+		dense_size = dense.capacity() * sizeof(row_t);
+		for (const auto& row : dense)
+			dense_size += row.capacity() * sizeof(elem_t);
+	}
+};
+
+#endif /* _STORAGE_HPP_ */
@@ -3,11 +3,23 @@
  * Author: Marius Mikucionis <marius@cs.aau.dk>
  */
 #include "csvtable.hpp"
+#include "journal.hpp"
+#include "storage.hpp"
+#include "sampler.hpp"
+#include "linalg.hpp"
+#include "workers.hpp"
+#include "trace.hpp"
 #include "errors.hpp"
 #include "dynlib.h"
 #include <fstream>
 #include <string>  // to_string/MSVC
 #include <cmath>   // nan
+#include <limits>  // numeric_limits
+#include <new>     // bad_alloc
+#include <atomic>
+#include <future>
+#include <memory>  // unique_ptr
+#include <mutex>
 
 C_PUBLIC int table_new_int(int rows, int cols, int value);
 C_PUBLIC int table_new_double(int rows, int cols, double value);
@@ -26,310 +38,1191 @@ C_PUBLIC void write_double(int id, int row, int col, double value);
 C_PUBLIC double interpolate(int id, double key, int key_col, int valu_col);
 C_PUBLIC void read_int_col(int id, int row, int col, int* items, int offset, int count);
 C_PUBLIC void read_int_row(int id, int row, int col, int* items, int offset, int count);
+C_PUBLIC int table_last_error();
+C_PUBLIC int table_error_count();
+C_PUBLIC int table_checkpoint(int id);
+C_PUBLIC int table_rollback(int id, int token);
+C_PUBLIC int table_release(int id, int token);
+C_PUBLIC int table_sampler_build(int id, int value_col, int weight_col);
+C_PUBLIC double table_sample(int sampler, double u1, double u2);
+C_PUBLIC double table_sample_continuous(int sampler, double u);
+C_PUBLIC int table_new_sparse_int(int rows, int cols, int value);
+C_PUBLIC int table_new_sparse_double(int rows, int cols, double value);
+C_PUBLIC int table_is_sparse(int id);
+C_PUBLIC int table_read_csv_async(const char* csv_path, int skip_lines);
+C_PUBLIC int table_ready(int id);
+C_PUBLIC int table_matvec(int id, const double* in, int in_count, double* out, int out_count);
+C_PUBLIC int table_mlp_eval(const int* layer_ids, const int* activations, int layers,
+							const double* in, int in_count, double* out, int out_count);
+C_PUBLIC double table_memory_bytes(int id);
+C_PUBLIC double table_memory_total();
+C_PUBLIC int table_set_memory_limit(double bytes);
 
-using namespace std::string_literals;
+/** Error codes reported by table_last_error(). */
+enum table_error_t : int {
+	TABLE_OK = 0,              // no error
+	TABLE_BAD_ID = 1,          // table id is out of range
+	TABLE_BAD_ROW = 2,         // row index is out of range
+	TABLE_BAD_COL = 3,         // column index is out of range
+	TABLE_BAD_SIZE = 4,        // negative dimensions, counts or offsets
+	TABLE_IO_ERROR = 5,        // failed to read or write a file
+	TABLE_NO_MEMORY = 6,       // memory allocation failed
+	TABLE_BAD_TOKEN = 7,       // checkpoint token is not open
+	TABLE_BAD_WEIGHT = 8,      // sampling weights are negative or do not add up to positive
+	TABLE_BAD_SHAPE = 9,       // table dimensions do not match the vector sizes
+	TABLE_BAD_ACTIVATION = 10, // unknown activation function
+	TABLE_OVER_LIMIT = 11      // the memory limit would be exceeded
+};
 
-static std::vector<table_t> tables{};
+/** Table read from a CSV file and the cause of failure (the table is empty then) */
+struct loaded_t
+{
+	table_t table;
+	table_error_t error = TABLE_OK;
+};
 
-C_PUBLIC int table_new_int(int rows, int cols, int value)
+/** Background loading of a table: the result is moved into the entry on the first access */
+struct loading_t
 {
-	log_err("table_new(%d, %d, %d)", rows, cols, value);
-	auto& t = tables.emplace_back();
-	t.resize(static_cast<size_t>(rows));
-	for (auto& row : t)
-		row.resize(static_cast<size_t>(cols), value);
-	const auto res = static_cast<int>(tables.size()) - 1;
-	log_err("table_new: ", res);
-	return res;
+	std::future<loaded_t> result;
+	std::mutex mutex;				 // serializes the threads waiting for the result
+	std::atomic<bool> done = false;	 // the result has been moved into the table
+	table_error_t error = TABLE_OK;	 // the outcome, valid when done
+	explicit loading_t(std::future<loaded_t>&& result): result{std::move(result)} {}
+};
+
+/** Table data with its bookkeeping */
+struct entry_t
+{
+	storage_t table;
+	journal_t journal;					 // undo log, active while checkpoints are open
+	std::unique_ptr<loading_t> loading;	 // set if the table is read in background
+	size_t bytes = 0;					 // accounted memory of the table and its journal
+	explicit entry_t(storage_t&& table): table{std::move(table)} {}
+	explicit entry_t(std::future<loaded_t>&& result):
+		loading{std::make_unique<loading_t>(std::move(result))}
+	{}
+	/** Whether the table data is still to be taken from the background loading */
+	bool pending() const
+	{
+		return loading != nullptr && !loading->done.load(std::memory_order_acquire);
+	}
+};
+
+static std::vector<entry_t> tables{};
+static std::vector<sampler_t> samplers{};
+
+static auto memory_used = std::atomic<size_t>{0};  // bytes accounted in tables and samplers
+static auto memory_limit = std::numeric_limits<double>::infinity();
+
+static thread_local auto last_error = int{TABLE_OK};
+static thread_local auto error_count = 0;
+
+/** Records the cause of a failure for the calling thread */
+static void set_error(table_error_t code)
+{
+	last_error = code;
+	++error_count;
 }
 
-C_PUBLIC int table_new_double(int rows, int cols, double value)
+/** User function: return the code of the most recent failure in this thread (0 if none) */
+static int table_last_error_impl() { return last_error; }
+
+/** User function: return the number of failures in this thread so far */
+static int table_error_count_impl() { return error_count; }
+
+/** Internal function updating the accounted bytes after the table or its journal has changed */
+static void account(entry_t& entry)
 {
-	log_err("table_new(%d, %d, %f)", rows, cols, value);
-	auto& t = tables.emplace_back();
-	t.resize(static_cast<size_t>(rows));
-	for (auto& row : t)
-		row.resize(static_cast<size_t>(cols), value);
-	const auto res = static_cast<int>(tables.size()) - 1;
-	log_err("table_new: ", res);
-	return res;
+	const auto bytes = entry.table.bytes() + entry.journal.bytes();
+	memory_used += bytes - entry.bytes;	 // modulo arithmetic handles the decrease too
+	entry.bytes = bytes;
 }
 
-static table_t load(const std::string& path, int skip_lines)
+/** Internal function checking whether extra bytes fit into the memory limit */
+static bool fits(double extra)
 {
-#ifdef ENABLE_CSV_CACHE
-	static auto cache = std::unordered_map<std::string, table_t>{};
-	auto it = cache.find(path);
-	if (it == cache.end()) {
-		log_err("No table in cache, loading from scratch");
-		auto is = std::ifstream{path};
-		is.peek();
-		if (!is || is.eof()) {
-			log_err("failed to read: %s", path.c_str());
+	return static_cast<double>(memory_used.load(std::memory_order_relaxed)) + extra <= memory_limit;
+}
+
+/**
+ * Internal function checking the memory limit before an allocation.
+ * @param extra the number of bytes to be allocated (negative if memory is released)
+ * @return false if the limit would be exceeded (the cause is recorded)
+ */
+static bool within_limit(double extra, const char* what)
+{
+	if (fits(extra)) [[likely]]
+		return true;
+	// logged in release builds too, otherwise the reason of the failure would be lost
+	log_error(__FUNCTION__, __FILE__, __LINE__,
+			  "%s needs %.0f bytes, but %zu of %.0f bytes are used", what, extra,
+			  memory_used.load(), memory_limit);
+	set_error(TABLE_OVER_LIMIT);
+	return false;
+}
+
+/**
+ * Internal function waiting for the background loading and moving its result into the table.
+ * Only the first caller waits for the worker, others wait for the first one.
+ */
+static void finish_loading(entry_t& entry)
+{
+	auto& loading = *entry.loading;
+	auto lock = std::lock_guard{loading.mutex};
+	if (loading.done.load(std::memory_order_relaxed))
+		return;
+	try {
+		auto loaded = loading.result.get();
+		entry.table = storage_t{std::move(loaded.table)};
+		loading.error = loaded.error;
+		if (!fits(static_cast<double>(entry.table.bytes()))) {
+			log_error(__FUNCTION__, __FILE__, __LINE__,
+					  "loaded table of %zu bytes exceeds the memory limit", entry.table.bytes());
+			entry.table.clear();
+			loading.error = TABLE_OVER_LIMIT;
 		}
-		bool res = false;
-		std::tie(it, res) = cache.emplace(path, table_read_csv(is, skip_lines));
-	} else {
-		log_err("Found table in cache");
+		account(entry);
+	} catch (std::exception& e) {  // the worker could not allocate the task
+		log_err("background loading failed: %s", e.what());
+		loading.error = TABLE_NO_MEMORY;
 	}
-	return it->second;
-#else
+	if (loading.error != TABLE_OK) {
+		log_err("failed to load table in background: error %d", loading.error);
+		set_error(loading.error);
+	}
+	loading.done.store(true, std::memory_order_release);
+}
+
+/**
+ * Internal function to look up the table entry without throwing.
+ * Negative ids wrap around to large unsigned values, thus one comparison covers both bounds.
+ * Waits for the table if it is still being loaded in background.
+ * @return the entry pointer or nullptr if the id is out of range
+ */
+static entry_t* find_entry(int id)
+{
+	if (static_cast<size_t>(id) >= tables.size()) [[unlikely]] {
+		log_err("table id is out of range: %d", id);
+		set_error(TABLE_BAD_ID);
+		return nullptr;
+	}
+	auto& entry = tables[static_cast<size_t>(id)];
+	if (entry.pending()) [[unlikely]]
+		finish_loading(entry);
+	return &entry;
+}
+
+static storage_t* find_table(int id)
+{
+	auto* entry = find_entry(id);
+	return (entry != nullptr) ? &entry->table : nullptr;
+}
+
+/** Internal function creating a new table filled with the value */
+static int new_table(int rows, int cols, double value, bool sparse)
+{
+	if (rows < 0 || cols < 0) [[unlikely]] {
+		log_err("negative table dimensions: %d, %d", rows, cols);
+		set_error(TABLE_BAD_SIZE);
+		return -1;
+	}
+	const auto bytes =
+		sparse ? 0.0 : storage_t::dense_bytes(static_cast<size_t>(rows), static_cast<size_t>(cols));
+	if (!within_limit(bytes, "new table"))
+		return -1;
+	try {
+		tables.emplace_back(
+			storage_t{static_cast<size_t>(rows), static_cast<size_t>(cols), value, sparse});
+		account(tables.back());
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate %d x %d table", rows, cols);
+		set_error(TABLE_NO_MEMORY);
+		return -1;
+	}
+	return static_cast<int>(tables.size()) - 1;
+}
+
+/** User function: create a table filled with the value, return its id or -1 on error.
+ * Large tables are sparse: memory is allocated only for the cells written with other values. */
+static int table_new_double_impl(int rows, int cols, double value)
+{
+	log_err("table_new(%d, %d, %f)", rows, cols, value);
+	const auto cells = static_cast<double>(rows) * static_cast<double>(cols);	 // no overflow
+	const auto sparse = cells >= static_cast<double>(storage_t::sparse_min_cells);
+	const auto res = new_table(rows, cols, value, sparse);
+	log_err("table_new: %d", res);
+	return res;
+}
+
+static int table_new_int_impl(int rows, int cols, int value)
+{
+	return table_new_double_impl(rows, cols, static_cast<double>(value));
+}
+
+/** User function: create a sparse table filled with the value regardless of its size.
+ * The table becomes dense when a quarter of its cells are written with other values. */
+static int table_new_sparse_double_impl(int rows, int cols, double value)
+{
+	log_err("table_new_sparse(%d, %d, %f)", rows, cols, value);
+	const auto res = new_table(rows, cols, value, true);
+	log_err("table_new_sparse: %d", res);
+	return res;
+}
+
+static int table_new_sparse_int_impl(int rows, int cols, int value)
+{
+	return table_new_sparse_double_impl(rows, cols, static_cast<double>(value));
+}
+
+/** User function: return 1 if the table is sparse, 0 if dense, or -1 on error */
+static int table_is_sparse_impl(int id)
+{
+	auto* table = find_table(id);
+	if (table == nullptr)
+		return -1;
+	return table->is_sparse() ? 1 : 0;
+}
+
+static loaded_t read_file(const std::string& path, int skip_lines)
+{
+	auto res = loaded_t{};
 	auto is = std::ifstream{path};
 	is.peek();
-	if (!is || is.eof()) {
-		log_err("failed to read \"%s\": ", path.c_str());
+	if (!is || is.eof())
+		res.error = TABLE_IO_ERROR;
+	res.table = table_read_csv(is, skip_lines);
+	return res;
+}
+
+/** Reads the table from CSV file, the table is empty upon errors.
+ * Runs in the worker threads too, thus the caller reports the errors. */
+static loaded_t load(const std::string& path, int skip_lines)
+{
+#ifdef ENABLE_CSV_CACHE
+	static auto cache = std::unordered_map<std::string, loaded_t>{};
+	static auto cache_mutex = std::mutex{};
+	{
+		auto lock = std::lock_guard{cache_mutex};
+		if (auto it = cache.find(path); it != cache.end())
+			return it->second;
 	}
-	return table_read_csv(is, skip_lines);
+	auto res = read_file(path, skip_lines);	 // outside the lock, so that files load in parallel
+	auto lock = std::lock_guard{cache_mutex};
+	return cache.emplace(path, std::move(res)).first->second;
+#else
+	return read_file(path, skip_lines);
 #endif
 }
 
 /** loads the table from CSV file, returns the table id, or -1 on error */
-C_PUBLIC int table_read_csv(const char* csv_path, int skip_lines)
+static int table_read_csv_impl(const char* csv_path, int skip_lines)
 {
 	log_err("table_read_csv(%s, %d)", csv_path, skip_lines);
-	tables.push_back(load(csv_path, skip_lines));  // empty table in case of errors
+	try {
+		auto loaded = load(csv_path, skip_lines);
+		if (loaded.error != TABLE_OK) {
+			log_err("failed to read \"%s\": ", csv_path);
+			set_error(loaded.error);
+		}
+		auto table = storage_t{std::move(loaded.table)};  // empty table upon errors
+		if (!within_limit(static_cast<double>(table.bytes()), csv_path))
+			return -1;
+		tables.emplace_back(std::move(table));
+		account(tables.back());
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate table for %s", csv_path);
+		set_error(TABLE_NO_MEMORY);
+		return -1;
+	}
 	auto res = static_cast<int>(tables.size()) - 1;
 	log_err("table_read_csv: id=%d", res);
 	return res;
 }
 
-/** writes the table to CSV file, returns the number of rows, or -1 on error */
-C_PUBLIC int table_write_csv(const int id, const char* csv_path)
+/** User function: start loading the table from CSV file in background, return its id or -1.
+ * Several tables load concurrently on a pool of worker threads and the first access to the table
+ * waits for that table only. */
+static int table_read_csv_async_impl(const char* csv_path, int skip_lines)
 {
-	log_err("table_write_csv(%d, %s)", id, csv_path);
-	if (id < 0) {
-		log_err("table id is too low: %d", id);
+	log_err("table_read_csv_async(%s, %d)", csv_path, skip_lines);
+	static auto workers = worker_pool_t{};	// started on first use, stopped before tables go
+	try {
+		auto result = workers.submit([path = std::string{csv_path}, skip_lines] {
+			try {
+				return load(path, skip_lines);
+			} catch (std::bad_alloc&) {
+				return loaded_t{{}, TABLE_NO_MEMORY};
+			}
+		});
+		tables.emplace_back(std::move(result));
+	} catch (std::exception& e) {  // bad_alloc or system_error from starting a thread
+		log_err("failed to start loading %s: %s", csv_path, e.what());
+		set_error(TABLE_NO_MEMORY);
 		return -1;
 	}
-	if (id >= static_cast<int>(tables.size())) {
-		log_err("table id is too high: %d", id);
+	auto res = static_cast<int>(tables.size()) - 1;
+	log_err("table_read_csv_async: id=%d", res);
+	return res;
+}
+
+/** User function: return 1 if the table is loaded, 0 if it is still loading in background,
+ * or -1 if the id is out of range or the loading failed (the table is empty then). */
+static int table_ready_impl(int id)
+{
+	if (static_cast<size_t>(id) >= tables.size()) [[unlikely]] {
+		log_err("table id is out of range: %d", id);
+		set_error(TABLE_BAD_ID);
 		return -1;
 	}
+	auto& entry = tables[static_cast<size_t>(id)];
+	if (entry.loading == nullptr)
+		return 1;
+	if (entry.pending()) {
+		{
+			auto& loading = *entry.loading;
+			auto lock = std::unique_lock{loading.mutex, std::try_to_lock};
+			if (!lock || loading.result.wait_for(std::chrono::seconds{0}) !=
+							 std::future_status::ready)
+				return 0;  // the worker (or another thread taking the result) is not done yet
+		}
+		finish_loading(entry);
+	}
+	return (entry.loading->error == TABLE_OK) ? 1 : -1;
+}
+
+/** writes the table to CSV file, returns the number of rows, or -1 on error */
+static int table_write_csv_impl(const int id, const char* csv_path)
+{
+	log_err("table_write_csv(%d, %s)", id, csv_path);
+	auto* table = find_table(id);
+	if (table == nullptr)
+		return -1;
 	auto os = std::ofstream{csv_path};
 	if (!os) {
 		log_err("failed to write: %s", csv_path);
+		set_error(TABLE_IO_ERROR);
 		return -1;
 	}
-	table_write_csv(os, tables[static_cast<size_t>(id)], ',');
-	auto res = static_cast<int>(tables[static_cast<size_t>(id)].size());
+	table->write_csv(os, ',');
+	auto res = static_cast<int>(table->rows());
 	log_err("table_write_csv: %d (rows)", res);
 	return res;
 }
 
-C_PUBLIC int table_copy(const int id)
+static int table_copy_impl(const int id)
 {
 	log_err("table_copy(%d)", id);
-	if (id < 0) {
-		log_err("table id is too low: %d", id);
+	auto* table = find_table(id);
+	if (table == nullptr || !within_limit(static_cast<double>(table->bytes()), "table copy"))
 		return -1;
-	}
-	if (id >= static_cast<int>(tables.size())) {
-		log_err("table id is too high: %d", id);
+	try {
+		auto copy = *table;  // copy before emplace_back as it may invalidate the reference
+		tables.emplace_back(std::move(copy));
+		account(tables.back());
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate a copy of table %d", id);
+		set_error(TABLE_NO_MEMORY);
 		return -1;
 	}
-	tables.push_back(tables[static_cast<size_t>(id)]);
 	auto res = static_cast<int>(tables.size()) - 1;
 	log_err("table_copy: %d (id)", res);
 	return res;
 }
 
-C_PUBLIC int table_clear(int id)
+static int table_clear_impl(int id)
 {
 	log_err("table_clear(%d)", id);
-	if (id < 0) {
-		log_err("table id is too low: %d", id);
-		return -1;
-	}
-	if (id >= static_cast<int>(tables.size())) {
-		log_err("table id is too high: %d", id);
+	auto* entry = find_entry(id);
+	if (entry == nullptr)
 		return -1;
+	if (entry->journal.active()) {
+		const auto bytes = entry->journal.record_shape_bytes(entry->table, 0, 0);
+		if (!within_limit(static_cast<double>(bytes), "table clear"))
+			return -1;
+		try {
+			entry->journal.record_shape(entry->table, 0, 0);
+		} catch (std::bad_alloc&) {
+			log_err("failed to record the table %d in journal", id);
+			set_error(TABLE_NO_MEMORY);
+			return -1;
+		}
 	}
-	tables[static_cast<size_t>(id)].clear();
-	tables[static_cast<size_t>(id)].shrink_to_fit();
+	entry->table.clear();
+	account(*entry);
 	log_err("table_clear: %d (id)", id);
 	return id;
 }
 
 /** User function: get the number of rows in the table */
-C_PUBLIC int table_rows(const int id)
+static int table_rows_impl(const int id)
 {
 	log_err("table_rows(%d)", id);
-	if (id < 0) {
-		log_err("table id is too low: %d", id);
+	auto* table = find_table(id);
+	if (table == nullptr)
 		return -1;
-	}
-	if (id >= static_cast<int>(tables.size())) {
-		log_err("table id is too high: %d", id);
-		return -1;
-	}
-	auto res = static_cast<int>(tables[static_cast<size_t>(id)].size());
+	auto res = static_cast<int>(table->rows());
 	log_err("table_rows: %d (rows)", res);
 	return res;
 }
 
 /** User function: get the number of columns in the first table row.
  * Note that some rows may have fewer or more columns (depends on the source of data). */
-C_PUBLIC int table_cols(const int id)
+static int table_cols_impl(const int id)
 {
 	log_err("table_cols(%d)", id);
-	if (id < 0) {
-		log_err("table id is too low: %d", id);
+	auto* table = find_table(id);
+	if (table == nullptr)
 		return -1;
-	}
-	if (id >= static_cast<int>(tables.size())) {
-		log_err("table id is too high: %d", id);
-		return -1;
-	}
-	if (tables[static_cast<size_t>(id)].empty()) {
+	if (table->rows() == 0) {
 		log_err("%s", "table is empty");
 		return 0;
 	}
-	const auto res = static_cast<int>(tables[static_cast<size_t>(id)].front().size());
+	const auto res = static_cast<int>(table->cols(0));
 	log_err("table_rows: %d (cols)", res);
 	return res;
 }
 
-static table_t& get_table(int id)
-{
-	if (id < 0)
-		throw std::runtime_error("table id too low: "s + std::to_string(id));
-	if (id >= static_cast<int>(tables.size()))
-		throw std::runtime_error("table id too high: "s + std::to_string(id));
-	return tables[static_cast<size_t>(id)];
-}
-
 /**
  * Internal function wrapping all the table accesses with range checks.
+ * Uses plain branches instead of exceptions, so that probing outside the table stays cheap.
  * @param row the row number
  * @param col the column number
- * @return the element reference at row:col
+ * @return true if row:col is in the table, otherwise the cause is recorded
  */
-static elem_t& access(int id, int row, int col)
-{
-	using namespace std::string_literals;
-	auto& table = get_table(id);
-	if (row < 0)
-		throw std::runtime_error("negative row: "s + std::to_string(row));
-	if (static_cast<int>(table.size()) <= row)
-		throw std::runtime_error("row overflow: "s + std::to_string(row));
-	if (col < 0)
-		throw std::runtime_error("negative column: "s + std::to_string(col));
-	auto& table_row = table[static_cast<size_t>(row)];
-	if (static_cast<int>(table_row.size()) <= col)
-		throw std::runtime_error("column overflow: "s + std::to_string(col));
-	return table_row[static_cast<size_t>(col)];
-}
-
-/** User function: read a floating point number at row:col in the table. */
-C_PUBLIC double read_double(int id, int row, int col)
+static bool in_range(const storage_t& table, int row, int col)
 {
-	try {
-		return access(id, row, col);
-	} catch (std::runtime_error& e [[maybe_unused]]) {
-		log_err("%s", e.what());
+	if (static_cast<size_t>(row) >= table.rows()) [[unlikely]] {
+		log_err("row is out of range: %d", row);
+		set_error(TABLE_BAD_ROW);
+		return false;
 	}
-	return std::nan("");
+	if (static_cast<size_t>(col) >= table.cols(static_cast<size_t>(row))) [[unlikely]] {
+		log_err("column is out of range: %d", col);
+		set_error(TABLE_BAD_COL);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Internal function reading the cell with the dense tables on the fast path.
+ * @return false if row:col is out of range (the cause is recorded)
+ */
+static bool read_cell(int id, int row, int col, elem_t& value)
+{
+	const auto* table = find_table(id);
+	if (table == nullptr) [[unlikely]]
+		return false;
+	const auto r = static_cast<size_t>(row);
+	const auto c = static_cast<size_t>(col);
+	if (const auto* rows = table->rows_data(); rows != nullptr && r < rows->size()) [[likely]] {
+		const auto& table_row = (*rows)[r];
+		if (c < table_row.size()) [[likely]] {
+			value = table_row[c];
+			return true;
+		}
+	}
+	if (!in_range(*table, row, col))
+		return false;
+	value = table->get(r, c);  // sparse table
+	return true;
+}
+
+/** User function: read a floating point number at row:col in the table, NaN if out of range. */
+static double read_double_impl(int id, int row, int col)
+{
+	auto value = elem_t{};
+	if (!read_cell(id, row, col, value)) [[unlikely]]
+		return std::nan("");
+	return value;
 }
 
-C_PUBLIC int read_int(int id, int row, int col) { return (int)read_double(id, row, col); }
+/** User function: read an integer at row:col in the table, INT_MIN if out of range. */
+static int read_int_impl(int id, int row, int col)
+{
+	auto value = elem_t{};
+	if (!read_cell(id, row, col, value)) [[unlikely]]
+		return std::numeric_limits<int>::min();
+	return static_cast<int>(value);
+}
 
 /** User function: resize the entire table to a given rectangular size. Return id on success */
-C_PUBLIC int table_resize_double(int id, int rows, int cols, double value)
+static int table_resize_double_impl(int id, int rows, int cols, double value)
 {
-	auto& table = get_table(id);
+	auto* entry = find_entry(id);
+	if (entry == nullptr)
+		return -1;
 	if (rows < 0) {
 		log_err("negative row number: %d", rows);
+		set_error(TABLE_BAD_SIZE);
 		return -1;
 	}
 	if (cols < 0) {
 		log_err("negative column number: %d", cols);
+		set_error(TABLE_BAD_SIZE);
 		return -1;
 	}
-	table.resize(static_cast<size_t>(rows));
-	for (auto& row : table)
-		row.resize(static_cast<size_t>(cols), value);
+	auto& table = entry->table;
+	const auto dense_bytes =
+		storage_t::dense_bytes(static_cast<size_t>(rows), static_cast<size_t>(cols));
+	auto bytes = !table.is_sparse() ? dense_bytes - static_cast<double>(table.bytes())
+				 : (value == table.fill())
+					 ? 0.0	// sparse table stays sparse and only drops cells
+					 : dense_bytes;  // the sparse cells are held until copied into rows
+	if (entry->journal.active())  // the cells outside the new shape are copied into the journal
+		bytes += static_cast<double>(entry->journal.record_shape_bytes(
+			table, static_cast<size_t>(rows), static_cast<size_t>(cols)));
+	if (!within_limit(bytes, "table resize"))
+		return -1;
+	try {
+		if (entry->journal.active())
+			entry->journal.record_shape(table, static_cast<size_t>(rows),
+										static_cast<size_t>(cols));
+		table.resize(static_cast<size_t>(rows), static_cast<size_t>(cols), value);
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate %d x %d table", rows, cols);
+		set_error(TABLE_NO_MEMORY);
+		account(*entry);
+		return -1;
+	}
+	account(*entry);
 	return id;
 }
 
 /** User function: resize the entire table to a given rectangular size. Return id on success */
-C_PUBLIC int table_resize_int(int id, int rows, int cols, int value)
+static int table_resize_int_impl(int id, int rows, int cols, int value)
 {
-	auto& table = get_table(id);
-	if (rows < 0) {
-		log_err("negative row number: %d", rows);
-		return -1;
+	return table_resize_double_impl(id, rows, cols, static_cast<double>(value));
+}
+
+static void write_double_impl(int id, int row, int col, double value)
+{
+	auto* entry = find_entry(id);
+	if (entry == nullptr || !in_range(entry->table, row, col)) [[unlikely]]
+		return;
+	auto& table = entry->table;
+	const auto r = static_cast<size_t>(row);
+	const auto c = static_cast<size_t>(col);
+	if (!table.is_sparse() && !entry->journal.active()) [[likely]] {
+		table.set(r, c, value);
+		return;
 	}
-	if (cols < 0) {
-		log_err("negative column number: %d", cols);
+	auto bytes = 0.0;
+	if (entry->journal.active())
+		bytes += static_cast<double>(entry->journal.record_write_bytes());
+	if (const auto* cells = table.sparse_data()) {
+		bytes += static_cast<double>(cells->set_bytes());
+		if (table.dense_at(cells->stored() + 1))  // adapt() converts the table to dense
+			bytes += storage_t::dense_bytes(cells->rows(), cells->cols());
+	}
+	if (!within_limit(bytes, "write"))
+		return;
+	try {
+		if (entry->journal.active())
+			entry->journal.record_write(row, col, table.get(r, c));
+		table.set(r, c, value);
+		table.adapt();
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate memory for writing to table %d", id);
+		set_error(TABLE_NO_MEMORY);
+	}
+	account(*entry);
+}
+
+static void write_int_impl(int id, int row, int col, int value)
+{
+	write_double_impl(id, row, col, value);
+}
+
+static double interpolate_impl(int id, double key, int key_col, int valu_col)
+{
+	auto* table = find_table(id);
+	if (table == nullptr)
+		return 0.0;
+	if (table->rows() == 0) {
+		log_err("%s", "table is empty");
+		set_error(TABLE_BAD_ROW);
+		return 0.0;
+	}
+	const auto cols = table->cols(0);
+	if (static_cast<size_t>(key_col) >= cols || static_cast<size_t>(valu_col) >= cols) {
+		log_err("column is out of range: %d or %d", key_col, valu_col);
+		set_error(TABLE_BAD_COL);
+		return 0.0;
+	}
+	return interpolate(
+		table->rows(), [table](size_t r, size_t c) { return table->get(r, c); }, key,
+		static_cast<size_t>(key_col), static_cast<size_t>(valu_col));
+}
+
+/** User function: open a (nested) checkpoint of the table modifications.
+ * Returns a token for table_rollback and table_release, or -1 on error */
+static int table_checkpoint_impl(int id)
+{
+	log_err("table_checkpoint(%d)", id);
+	auto* entry = find_entry(id);
+	if (entry == nullptr)
+		return -1;
+	try {
+		const auto token = entry->journal.checkpoint();
+		account(*entry);
+		return token;
+	} catch (std::bad_alloc&) {
+		log_err("failed to open a checkpoint for table %d", id);
+		set_error(TABLE_NO_MEMORY);
 		return -1;
 	}
-	table.resize(static_cast<size_t>(rows));
-	for (auto& row : table)
-		row.resize(static_cast<size_t>(cols), value);
-	return id;
 }
 
-C_PUBLIC void write_double(int id, int row, int col, double value)
+/** User function: undo the table modifications since the checkpoint (which stays open).
+ * The cost is proportional to the number of modifications. Returns id on success or -1 */
+static int table_rollback_impl(int id, int token)
 {
+	log_err("table_rollback(%d, %d)", id, token);
+	auto* entry = find_entry(id);
+	if (entry == nullptr)
+		return -1;
 	try {
-		access(id, row, col) = value;
-	} catch (std::runtime_error& e [[maybe_unused]]) {
-		log_err("%s", e.what());
+		if (!entry->journal.rollback(entry->table, token)) {
+			log_err("no such checkpoint: %d", token);
+			set_error(TABLE_BAD_TOKEN);
+			return -1;
+		}
+	} catch (std::bad_alloc&) {	 // restoring a shape re-grows the rows
+		log_err("failed to restore table %d to checkpoint %d", id, token);
+		set_error(TABLE_NO_MEMORY);
+		account(*entry);
+		return -1;
 	}
+	account(*entry);
+	return id;
 }
 
-C_PUBLIC void write_int(int id, int row, int col, int value) { write_double(id, row, col, value); }
+/** User function: close the checkpoint (and nested ones) keeping the modifications.
+ * The journal memory is released when the outermost checkpoint is closed. Returns id or -1 */
+static int table_release_impl(int id, int token)
+{
+	log_err("table_release(%d, %d)", id, token);
+	auto* entry = find_entry(id);
+	if (entry == nullptr)
+		return -1;
+	if (!entry->journal.release(token)) {
+		log_err("no such checkpoint: %d", token);
+		set_error(TABLE_BAD_TOKEN);
+		return -1;
+	}
+	account(*entry);
+	return id;
+}
 
-C_PUBLIC double interpolate(int id, double key, int key_col, int valu_col)
+/** User function: precompute a sampler of values in value_col with weights in weight_col.
+ * The sampler is a snapshot: later table modifications do not affect it.
+ * Returns the sampler id, or -1 on error */
+static int table_sampler_build_impl(int id, int value_col, int weight_col)
 {
-	auto res = 0.0;
+	log_err("table_sampler_build(%d, %d, %d)", id, value_col, weight_col);
+	auto* table = find_table(id);
+	if (table == nullptr)
+		return -1;
+	if (table->rows() == 0) {
+		log_err("%s", "table is empty");
+		set_error(TABLE_BAD_ROW);
+		return -1;
+	}
+	if (!within_limit(sampler_t::build_bytes(table->rows()), "sampler"))
+		return -1;
 	try {
-		auto& table = get_table(id);
-		res = interpolate(table, key, key_col, valu_col);
-	} catch (std::runtime_error& e [[maybe_unused]]) {
-		log_err("%s", e.what());
+		auto points = std::vector<sampler_t::point_t>{};
+		points.reserve(table->rows());
+		for (auto r = size_t{0}; r < table->rows(); ++r) {
+			if (static_cast<size_t>(value_col) >= table->cols(r) ||
+				static_cast<size_t>(weight_col) >= table->cols(r)) {
+				log_err("column is out of range: %d or %d", value_col, weight_col);
+				set_error(TABLE_BAD_COL);
+				return -1;
+			}
+			points.emplace_back(table->get(r, static_cast<size_t>(value_col)),
+								table->get(r, static_cast<size_t>(weight_col)));
+		}
+		auto sampler = sampler_t{};
+		if (!sampler.build(std::move(points))) {
+			log_err("invalid weights in column %d", weight_col);
+			set_error(TABLE_BAD_WEIGHT);
+			return -1;
+		}
+		samplers.push_back(std::move(sampler));
+		memory_used += samplers.back().bytes();
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate a sampler for table %d", id);
+		set_error(TABLE_NO_MEMORY);
+		return -1;
 	}
+	const auto res = static_cast<int>(samplers.size()) - 1;
+	log_err("table_sampler_build: %d", res);
 	return res;
 }
 
-C_PUBLIC void read_int_col(int id, int row, int col, int* items, int offset, int count)
+static const sampler_t* find_sampler(int sampler)
 {
+	if (static_cast<size_t>(sampler) >= samplers.size()) [[unlikely]] {
+		log_err("sampler id is out of range: %d", sampler);
+		set_error(TABLE_BAD_ID);
+		return nullptr;
+	}
+	return &samplers[static_cast<size_t>(sampler)];
+}
+
+/** User function: draw a value with probability proportional to its weight in O(1).
+ * u1 and u2 are independent uniform random numbers in [0,1). Returns NaN on error */
+static double table_sample_impl(int sampler, double u1, double u2)
+{
+	const auto* s = find_sampler(sampler);
+	if (s == nullptr) [[unlikely]]
+		return std::nan("");
+	return s->sample(u1, u2);
+}
+
+/** User function: draw a value from the piecewise-linear cumulative distribution of weights.
+ * u is a uniform random number in [0,1]. Returns NaN on error */
+static double table_sample_continuous_impl(int sampler, double u)
+{
+	const auto* s = find_sampler(sampler);
+	if (s == nullptr) [[unlikely]]
+		return std::nan("");
+	return s->sample_continuous(u);
+}
+
+/**
+ * Internal function to validate the bulk read arguments once per call.
+ * @return true if items[offset..offset+count) can be written
+ */
+static bool check_bulk(int row, int col, const int* items, int offset, int count)
+{
+	if (row < 0 || col < 0 || offset < 0 || count < 0 || items == nullptr) {
+		log_err("invalid bulk arguments: %d, %d, %p, %d, %d", row, col, items, offset, count);
+		set_error(TABLE_BAD_SIZE);
+		return false;
+	}
+	return true;
+}
+
+static void read_int_col_impl(int id, int row, int col, int* items, int offset, int count)
+{
+	log_err("read_int_col(%d, %d, %d, %p, %d %d)", id, row, col, items, offset, count);
+	auto* table = find_table(id);
+	if (table == nullptr || !check_bulk(row, col, items, offset, count))
+		return;
+	if (static_cast<size_t>(row) + static_cast<size_t>(count) > table->rows()) {
+		log_err("row range is beyond table size: %d + %d", row, count);
+		set_error(TABLE_BAD_ROW);
+		return;
+	}
+	const auto c = static_cast<size_t>(col);
+	auto* out = items + offset;
+	const auto* rows = table->rows_data();
+	if (rows == nullptr) {	// sparse tables are rectangular
+		if (count > 0 && c >= table->cols(0)) {
+			log_err("column is beyond table size: %d", col);
+			set_error(TABLE_BAD_COL);
+			return;
+		}
+		for (auto i = 0; i < count; ++i)
+			out[i] = static_cast<int>(table->get(static_cast<size_t>(row + i), c));
+		return;
+	}
+	auto rb = std::next(std::begin(*rows), row);
+	for (auto i = 0; i < count; ++i, ++rb) {
+		if (c >= rb->size()) [[unlikely]] {  // rows loaded from CSV may be ragged
+			log_err("column is beyond table size: %d in row %d", col, row + i);
+			set_error(TABLE_BAD_COL);
+			return;
+		}
+		out[i] = static_cast<int>((*rb)[c]);
+	}
+}
+
+static void read_int_row_impl(int id, int row, int col, int* items, int offset, int count)
+{
+	log_err("read_int_row(%d, %d, %d, %p, %d %d)", id, row, col, items, offset, count);
+	auto* table = find_table(id);
+	if (table == nullptr || !check_bulk(row, col, items, offset, count))
+		return;
+	if (static_cast<size_t>(row) >= table->rows()) {
+		log_err("row is beyond table size: %d", row);
+		set_error(TABLE_BAD_ROW);
+		return;
+	}
+	const auto r = static_cast<size_t>(row);
+	if (static_cast<size_t>(col) + static_cast<size_t>(count) > table->cols(r)) {
+		log_err("column range is beyond table size: %d + %d", col, count);
+		set_error(TABLE_BAD_COL);
+		return;
+	}
+	auto* out = items + offset;
+	if (const auto* rows = table->rows_data()) {
+		const auto* in = (*rows)[r].data() + col;
+		for (auto i = 0; i < count; ++i)
+			out[i] = static_cast<int>(in[i]);
+	} else {
+		for (auto i = 0; i < count; ++i)
+			out[i] = static_cast<int>(table->get(r, static_cast<size_t>(col + i)));
+	}
+}
+
+/** Internal function checking the array argument of count elements */
+static bool check_vector(const double* items, int count)
+{
+	if (count < 0 || (items == nullptr && count > 0)) {
+		log_err("invalid vector: %p, %d", items, count);
+		set_error(TABLE_BAD_SIZE);
+		return false;
+	}
+	return true;
+}
+
+/** Internal function checking that the table consists of rows of width cols */
+static bool check_shape(const storage_t& table, size_t rows, size_t cols)
+{
+	auto ok = table.rows() == rows;
+	for (auto r = size_t{0}; ok && r < rows; ++r)
+		ok = table.cols(r) == cols;
+	if (!ok) {
+		log_err("table shape does not match %zu x %zu", rows, cols);
+		set_error(TABLE_BAD_SHAPE);
+	}
+	return ok;
+}
+
+/** Internal function computing y = W * x, where W is the first n columns of the table */
+static void multiply(const storage_t& table, const double* x, size_t n, double* y)
+{
+	const auto m = table.rows();
+	if (const auto* rows = table.rows_data()) [[likely]] {
+		matvec(*rows, m, x, n, y);
+		return;
+	}
+	// sparse: every element is multiplied by the fill value and the stored cells add the difference
+	const auto& sparse = *table.sparse_data();
+	auto sum = 0.0;
+	for (auto c = size_t{0}; c < n; ++c)
+		sum += x[c];
+	std::fill(y, y + m, sparse.fill() * sum);
+	sparse.for_each([&](size_t r, size_t c, elem_t value) {
+		if (c < n)
+			y[r] += (value - sparse.fill()) * x[c];
+	});
+}
+
+/** User function: multiply the table (out_count rows x in_count columns) with the in vector.
+ * The vectors may be the same array. Returns out_count, or -1 on error (out is not modified). */
+static int table_matvec_impl(int id, const double* in, int in_count, double* out, int out_count)
+{
+	log_err("table_matvec(%d, %p, %d, %p, %d)", id, in, in_count, out, out_count);
+	const auto* table = find_table(id);
+	if (table == nullptr || !check_vector(in, in_count) || !check_vector(out, out_count) ||
+		!check_shape(*table, static_cast<size_t>(out_count), static_cast<size_t>(in_count)))
+		return -1;
+	static thread_local auto result = std::vector<double>{};  // in case out overlaps in
 	try {
-		log_err("read_int_col(%d, %d, %d, %p, %d %d)", id, row, col, items, offset, count);
-		auto& table = get_table(id);
-		if (row < 0)
-			throw std::runtime_error("negative row");
-		if (col < 0)
-			throw std::runtime_error("negative column");
-		if (row + count > static_cast<int>(table.size()))
-			throw std::runtime_error("row range is beyond table size");
-		if (col >= static_cast<int>(table[static_cast<size_t>(row)].size()))
-			throw std::runtime_error("column is beyond table size");
-		auto rb = std::next(std::begin(table), row), re = std::end(table);
-		for (auto i = 0; i < count && rb != re; ++i, ++rb)
-			items[offset + i] = static_cast<int>((*rb)[static_cast<size_t>(col)]);
-	} catch (std::runtime_error& e [[maybe_unused]]) {
-		log_err("%s", e.what());
+		result.resize(static_cast<size_t>(out_count));
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate vector of %d", out_count);
+		set_error(TABLE_NO_MEMORY);
+		return -1;
 	}
+	multiply(*table, in, static_cast<size_t>(in_count), result.data());
+	std::copy(result.begin(), result.end(), out);
+	return out_count;
 }
 
-C_PUBLIC void read_int_row(int id, int row, int col, int* items, int offset, int count)
+/**
+ * User function: evaluate a multi-layer perceptron on the in vector and store the result in out.
+ * Each layer is a table of rows (one per output) of weights (one per input) and a bias in the last
+ * column, followed by the activation function: 0-identity, 1-ReLU, 2-tanh.
+ * @return out_count, or -1 on error (out is not modified)
+ */
+static int table_mlp_eval_impl(const int* layer_ids, const int* activations, int layers,
+							   const double* in, int in_count, double* out, int out_count)
 {
+	log_err("table_mlp_eval(%p, %p, %d, %p, %d, %p, %d)", layer_ids, activations, layers, in,
+			in_count, out, out_count);
+	if (layers <= 0 || layer_ids == nullptr || activations == nullptr) {
+		log_err("invalid layers: %p, %p, %d", layer_ids, activations, layers);
+		set_error(TABLE_BAD_SIZE);
+		return -1;
+	}
+	if (!check_vector(in, in_count) || !check_vector(out, out_count))
+		return -1;
+	static thread_local auto weights = std::vector<const storage_t*>{};
+	static thread_local auto x = std::vector<double>{};
+	static thread_local auto y = std::vector<double>{};
 	try {
-		log_err("read_int_row(%d, %d, %d, %p, %d %d)", id, row, col, items, offset, count);
-		auto& table = get_table(id);
-		if (row < 0)
-			throw std::runtime_error("negative row");
-		if (col < 0)
-			throw std::runtime_error("negative column");
-		if (row >= static_cast<int>(table.size()))
-			throw std::runtime_error("row is beyond table size");
-		if (col + count > static_cast<int>(table[static_cast<size_t>(row)].size()))
-			throw std::runtime_error("column range is beyond table size");
-		auto rb = std::next(std::begin(table), row);
-		for (auto i = 0; i < count; ++i)
-			items[offset + i] = static_cast<int>((*rb)[static_cast<size_t>(col + i)]);
-	} catch (std::runtime_error& e [[maybe_unused]]) {
-		log_err("%s", e.what());
+		weights.clear();
+		auto width = static_cast<size_t>(in_count);
+		for (auto l = 0; l < layers; ++l) {	 // check all layers before computing
+			const auto* table = find_table(layer_ids[l]);
+			if (table == nullptr || !check_shape(*table, table->rows(), width + 1))
+				return -1;
+			if (static_cast<unsigned>(activations[l]) > ACT_TANH) {
+				log_err("unknown activation function %d in layer %d", activations[l], l);
+				set_error(TABLE_BAD_ACTIVATION);
+				return -1;
+			}
+			weights.push_back(table);
+			width = table->rows();
+		}
+		if (width != static_cast<size_t>(out_count)) {
+			log_err("the last layer has %zu outputs instead of %d", width, out_count);
+			set_error(TABLE_BAD_SHAPE);
+			return -1;
+		}
+		x.assign(in, in + in_count);
+		for (auto l = 0; l < layers; ++l) {
+			const auto& table = *weights[static_cast<size_t>(l)];
+			const auto n = x.size();
+			const auto m = table.rows();
+			y.resize(m);
+			multiply(table, x.data(), n, y.data());
+			for (auto r = size_t{0}; r < m; ++r)
+				y[r] += table.get(r, n);  // bias
+			activate(static_cast<activation_t>(activations[l]), y.data(), m);
+			std::swap(x, y);
+		}
+	} catch (std::bad_alloc&) {
+		log_err("failed to allocate layer vectors");
+		set_error(TABLE_NO_MEMORY);
+		return -1;
 	}
+	std::copy(x.begin(), x.end(), out);
+	return out_count;
+}
+
+/** User function: return the number of bytes held by the table and its journal, or -1 on error */
+static double table_memory_bytes_impl(int id)
+{
+	const auto* entry = find_entry(id);
+	if (entry == nullptr)
+		return -1;
+	return static_cast<double>(entry->bytes);
+}
+
+/** User function: return the number of bytes held by all tables, journals and samplers */
+static double table_memory_total_impl()
+{
+	return static_cast<double>(memory_used.load(std::memory_order_relaxed));
+}
+
+/** User function: limit the memory of tables, journals and samplers (no limit if not positive).
+ * Allocations beyond the limit fail instead of exhausting the memory. Returns 0. */
+static int table_set_memory_limit_impl(double bytes)
+{
+	log_err("table_set_memory_limit(%f)", bytes);
+	memory_limit = (bytes > 0) ? bytes : std::numeric_limits<double>::infinity();
+	return 0;
+}
+
+/* Exported functions forward to the implementations above and record the calls when tracing */
+
+C_PUBLIC int table_last_error() { return traced(op_t::table_last_error, table_last_error_impl); }
+
+C_PUBLIC int table_error_count()
+{
+	return traced(op_t::table_error_count, table_error_count_impl);
+}
+
+C_PUBLIC int table_new_int(int rows, int cols, int value)
+{
+	return traced(op_t::table_new_int, table_new_int_impl, rows, cols, value);
+}
+
+C_PUBLIC int table_new_double(int rows, int cols, double value)
+{
+	return traced(op_t::table_new_double, table_new_double_impl, rows, cols, value);
+}
+
+C_PUBLIC int table_read_csv(const char* csv_path, int skip_lines)
+{
+	return traced(op_t::table_read_csv, table_read_csv_impl, csv_path, skip_lines);
+}
+
+C_PUBLIC int table_write_csv(int id, const char* csv_path)
+{
+	return traced(op_t::table_write_csv, table_write_csv_impl, id, csv_path);
+}
+
+C_PUBLIC int table_copy(int id) { return traced(op_t::table_copy, table_copy_impl, id); }
+
+C_PUBLIC int table_clear(int id) { return traced(op_t::table_clear, table_clear_impl, id); }
+
+C_PUBLIC int table_rows(int id) { return traced(op_t::table_rows, table_rows_impl, id); }
+
+C_PUBLIC int table_cols(int id) { return traced(op_t::table_cols, table_cols_impl, id); }
+
+C_PUBLIC double read_double(int id, int row, int col)
+{
+	return traced(op_t::read_double, read_double_impl, id, row, col);
+}
+
+C_PUBLIC int read_int(int id, int row, int col)
+{
+	return traced(op_t::read_int, read_int_impl, id, row, col);
+}
+
+C_PUBLIC int table_resize_double(int id, int rows, int cols, double value)
+{
+	return traced(op_t::table_resize_double, table_resize_double_impl, id, rows, cols, value);
+}
+
+C_PUBLIC int table_resize_int(int id, int rows, int cols, int value)
+{
+	return traced(op_t::table_resize_int, table_resize_int_impl, id, rows, cols, value);
+}
+
+C_PUBLIC void write_double(int id, int row, int col, double value)
+{
+	traced(op_t::write_double, write_double_impl, id, row, col, value);
+}
+
+C_PUBLIC void write_int(int id, int row, int col, int value)
+{
+	traced(op_t::write_int, write_int_impl, id, row, col, value);
+}
+
+C_PUBLIC double interpolate(int id, double key, int key_col, int valu_col)
+{
+	return traced(op_t::interpolate, interpolate_impl, id, key, key_col, valu_col);
+}
+
+C_PUBLIC int table_checkpoint(int id)
+{
+	return traced(op_t::table_checkpoint, table_checkpoint_impl, id);
+}
+
+C_PUBLIC int table_rollback(int id, int token)
+{
+	return traced(op_t::table_rollback, table_rollback_impl, id, token);
+}
+
+C_PUBLIC int table_release(int id, int token)
+{
+	return traced(op_t::table_release, table_release_impl, id, token);
+}
+
+C_PUBLIC int table_sampler_build(int id, int value_col, int weight_col)
+{
+	return traced(op_t::table_sampler_build, table_sampler_build_impl, id, value_col, weight_col);
+}
+
+C_PUBLIC double table_sample(int sampler, double u1, double u2)
+{
+	return traced(op_t::table_sample, table_sample_impl, sampler, u1, u2);
+}
+
+C_PUBLIC double table_sample_continuous(int sampler, double u)
+{
+	return traced(op_t::table_sample_continuous, table_sample_continuous_impl, sampler, u);
+}
+
+C_PUBLIC int table_new_sparse_int(int rows, int cols, int value)
+{
+	return traced(op_t::table_new_sparse_int, table_new_sparse_int_impl, rows, cols, value);
+}
+
+C_PUBLIC int table_new_sparse_double(int rows, int cols, double value)
+{
+	return traced(op_t::table_new_sparse_double, table_new_sparse_double_impl, rows, cols, value);
+}
+
+C_PUBLIC int table_is_sparse(int id)
+{
+	return traced(op_t::table_is_sparse, table_is_sparse_impl, id);
+}
+
+C_PUBLIC int table_read_csv_async(const char* csv_path, int skip_lines)
+{
+	return traced(op_t::table_read_csv_async, table_read_csv_async_impl, csv_path, skip_lines);
+}
+
+C_PUBLIC int table_ready(int id) { return traced(op_t::table_ready, table_ready_impl, id); }
+
+C_PUBLIC double table_memory_bytes(int id)
+{
+	return traced(op_t::table_memory_bytes, table_memory_bytes_impl, id);
+}
+
+C_PUBLIC double table_memory_total()
+{
+	return traced(op_t::table_memory_total, table_memory_total_impl);
+}
+
+C_PUBLIC int table_set_memory_limit(double bytes)
+{
+	return traced(op_t::table_set_memory_limit, table_set_memory_limit_impl, bytes);
+}
+
+/** Returns the items written by a bulk read, or an empty span if the arguments are invalid */
+static std::span<const int> bulk_items(const int* items, int offset, int count)
+{
+	if (items == nullptr || offset < 0 || count < 0)
+		return {};
+	return {items + offset, static_cast<size_t>(count)};
+}
+
+/** Returns the items of an array argument, or an empty span if the arguments are invalid */
+template <typename T>
+static std::span<const T> array_items(const T* items, int count)
+{
+	if (items == nullptr || count < 0)
+		return {};
+	return {items, static_cast<size_t>(count)};
+}
+
+C_PUBLIC void read_int_col(int id, int row, int col, int* items, int offset, int count)
+{
+	if (!trace_on.load(std::memory_order_relaxed)) [[likely]]
+		return read_int_col_impl(id, row, col, items, offset, count);
+	const auto start = trace_ticks();
+	read_int_col_impl(id, row, col, items, offset, count);
+	trace_record(op_t::read_int_col, start, id, row, col, offset, count,
+				 bulk_items(items, offset, count));
+}
+
+C_PUBLIC void read_int_row(int id, int row, int col, int* items, int offset, int count)
+{
+	if (!trace_on.load(std::memory_order_relaxed)) [[likely]]
+		return read_int_row_impl(id, row, col, items, offset, count);
+	const auto start = trace_ticks();
+	read_int_row_impl(id, row, col, items, offset, count);
+	trace_record(op_t::read_int_row, start, id, row, col, offset, count,
+				 bulk_items(items, offset, count));
+}
+
+C_PUBLIC int table_matvec(int id, const double* in, int in_count, double* out, int out_count)
+{
+	if (!trace_on.load(std::memory_order_relaxed)) [[likely]]
+		return table_matvec_impl(id, in, in_count, out, out_count);
+	const auto start = trace_ticks();
+	const auto items = array_items(in, in_count);
+	const auto input = std::vector<double>(items.begin(), items.end());  // out may overlap in
+	const auto res = table_matvec_impl(id, in, in_count, out, out_count);
+	trace_record(op_t::table_matvec, start, id, in_count, out_count, std::span{input},
+				 array_items(out, out_count), res);
+	return res;
+}
+
+C_PUBLIC int table_mlp_eval(const int* layer_ids, const int* activations, int layers,
+							const double* in, int in_count, double* out, int out_count)
+{
+	if (!trace_on.load(std::memory_order_relaxed)) [[likely]]
+		return table_mlp_eval_impl(layer_ids, activations, layers, in, in_count, out, out_count);
+	const auto start = trace_ticks();
+	const auto items = array_items(in, in_count);
+	const auto input = std::vector<double>(items.begin(), items.end());  // out may overlap in
+	const auto res =
+		table_mlp_eval_impl(layer_ids, activations, layers, in, in_count, out, out_count);
+	trace_record(op_t::table_mlp_eval, start, layers, in_count, out_count,
+				 array_items(layer_ids, layers), array_items(activations, layers),
+				 std::span{input}, array_items(out, out_count), res);
+	return res;
 }
@@ -0,0 +1,385 @@
+/**
+ * Replays a binary trace of libtable calls recorded with LIBTABLE_TRACE or table_trace_start.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ *
+ * Usage: table_replay [--timed] [--verbose] path/to/libtable trace.bin
+ * The calls are replayed in the order of their start time (as fast as possible, or following
+ * the recorded timing with --timed) and the results are compared with the recorded ones.
+ */
+#include "library.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>  // isnan, llround
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <tuple>
+
+/** Decoded call ready to be replayed, returns whether the result matches the recording */
+struct call_t
+{
+	op_t op;
+	std::int64_t start;	  // nanoseconds since the start of recording
+	std::int64_t duration;	// recorded duration in nanoseconds
+	std::function<bool()> replay;
+};
+
+/** Statistics of one kind of calls */
+struct stats_t
+{
+	size_t calls = 0;
+	size_t mismatches = 0;
+	std::int64_t recorded = 0;	// total nanoseconds during recording
+	std::int64_t replayed = 0;	// total nanoseconds during replay
+};
+
+constexpr auto op_count = static_cast<size_t>(op_t::count);
+
+constexpr auto op_names = std::array<const char*, op_count>{
+	"none",
+#define TABLE_TRACE_NAME(name, ...) #name,
+	TABLE_TRACE_OPS(TABLE_TRACE_NAME)
+#undef TABLE_TRACE_NAME
+};
+
+/** Storage of decoded argument values */
+template <typename T>
+struct arg_storage
+{
+	using type = T;
+};
+template <>
+struct arg_storage<const char*>
+{
+	using type = std::string;
+};
+
+template <typename T>
+static T arg_value(const T& value)
+{
+	return value;
+}
+static const char* arg_value(const std::string& value) { return value.c_str(); }
+
+template <typename T>
+static bool same(const T& recorded, const T& replayed)
+{
+	if constexpr (std::is_floating_point_v<T>)
+		return recorded == replayed || (std::isnan(recorded) && std::isnan(replayed));
+	else
+		return recorded == replayed;
+}
+
+template <typename T>
+constexpr auto is_output_v = std::is_pointer_v<T> && !std::is_const_v<std::remove_pointer_t<T>>;
+
+/** Decodes calls of functions with scalar and string arguments */
+template <typename Signature>
+struct decoder;
+
+template <typename R, typename... Args>
+struct decoder<R(Args...)>
+{
+	static bool decode(trace_reader_t& reader, R (*fn)(Args...), call_t& call)
+	{
+		if constexpr ((is_output_v<Args> || ...))
+			return false;  // output arrays need a dedicated decoder
+		auto args = std::tuple<typename arg_storage<Args>::type...>{};
+		const auto ok = std::apply([&](auto&... arg) { return (reader.get(arg) && ...); }, args);
+		if (!ok)
+			return false;
+		if constexpr (std::is_void_v<R>) {
+			call.replay = [fn, args] {
+				std::apply([fn](const auto&... arg) { fn(arg_value(arg)...); }, args);
+				return true;
+			};
+		} else {
+			auto expected = R{};
+			if (!reader.get(expected))
+				return false;
+			call.replay = [fn, args, expected] {
+				const auto res =
+					std::apply([fn](const auto&... arg) { return fn(arg_value(arg)...); }, args);
+				return same(expected, res);
+			};
+		}
+		return true;
+	}
+};
+
+using bulk_fn = void (*)(int, int, int, int*, int, int);
+
+/** Decodes read_int_col and read_int_row calls whose items are recorded after the arguments */
+static bool decode_bulk(trace_reader_t& reader, bulk_fn fn, call_t& call)
+{
+	int id, row, col, offset, count;
+	auto expected = std::vector<int>{};
+	if (!reader.get(id) || !reader.get(row) || !reader.get(col) || !reader.get(offset) ||
+		!reader.get(count) || !reader.get(expected))
+		return false;
+	call.replay = [=] {
+		if (offset < 0 || count < 0) {
+			fn(id, row, col, nullptr, offset, count);
+			return true;
+		}
+		// start from the recorded items, so that untouched items match too
+		auto items = std::vector<int>(static_cast<size_t>(offset + count), 0);
+		std::copy(expected.begin(), expected.end(), items.begin() + offset);
+		fn(id, row, col, items.data(), offset, count);
+		return std::equal(expected.begin(), expected.end(), items.begin() + offset);
+	};
+	return true;
+}
+
+/** Returns the recorded array argument, or nullptr if the argument was invalid when recorded */
+template <typename Items>
+static auto array_arg(Items& items, int count)
+{
+	return (count >= 0 && items.size() == static_cast<size_t>(count)) ? items.data() : nullptr;
+}
+
+/** Compares the recorded and replayed output vectors of a successful call */
+static bool same_output(int res, const std::vector<double>& expected,
+						const std::vector<double>& replayed)
+{
+	return res < 0 || std::equal(expected.begin(), expected.end(), replayed.begin(),
+								 replayed.end(), same<double>);
+}
+
+using matvec_fn = int (*)(int, const double*, int, double*, int);
+
+/** Decodes table_matvec calls whose vectors are recorded after the sizes */
+static bool decode_matvec(trace_reader_t& reader, matvec_fn fn, call_t& call)
+{
+	int id, in_count, out_count, expected;
+	auto in = std::vector<double>{};
+	auto out = std::vector<double>{};
+	if (!reader.get(id) || !reader.get(in_count) || !reader.get(out_count) || !reader.get(in) ||
+		!reader.get(out) || !reader.get(expected))
+		return false;
+	call.replay = [=] {
+		auto items = out;
+		const auto res =
+			fn(id, array_arg(in, in_count), in_count, array_arg(items, out_count), out_count);
+		return res == expected && same_output(res, out, items);
+	};
+	return true;
+}
+
+using mlp_fn = int (*)(const int*, const int*, int, const double*, int, double*, int);
+
+/** Decodes table_mlp_eval calls whose arrays are recorded after the sizes */
+static bool decode_mlp(trace_reader_t& reader, mlp_fn fn, call_t& call)
+{
+	int layers, in_count, out_count, expected;
+	auto ids = std::vector<int>{};
+	auto activations = std::vector<int>{};
+	auto in = std::vector<double>{};
+	auto out = std::vector<double>{};
+	if (!reader.get(layers) || !reader.get(in_count) || !reader.get(out_count) ||
+		!reader.get(ids) || !reader.get(activations) || !reader.get(in) || !reader.get(out) ||
+		!reader.get(expected))
+		return false;
+	call.replay = [=] {
+		auto items = out;
+		const auto res = fn(array_arg(ids, layers), array_arg(activations, layers), layers,
+							array_arg(in, in_count), in_count, array_arg(items, out_count),
+							out_count);
+		return res == expected && same_output(res, out, items);
+	};
+	return true;
+}
+
+using ready_fn = int (*)(int);
+
+/** Decodes table_ready calls: the readiness depends on timing, thus only failures must match */
+static bool decode_ready(trace_reader_t& reader, ready_fn fn, call_t& call)
+{
+	int id, expected;
+	if (!reader.get(id) || !reader.get(expected))
+		return false;
+	call.replay = [=] { return (fn(id) < 0) == (expected < 0); };
+	return true;
+}
+
+/** Looks up the library functions on demand and decodes their calls */
+class replayer_t
+{
+	using any_fn = void (*)();
+	Library& lib;
+	std::array<any_fn, op_count> fns{};
+
+	template <typename Fn>
+	Fn lookup(op_t op)
+	{
+		auto& fn = fns[static_cast<size_t>(op)];
+		if (fn == nullptr)
+			fn = reinterpret_cast<any_fn>(lib.lookup<Fn>(op_names[static_cast<size_t>(op)]));
+		return reinterpret_cast<Fn>(fn);
+	}
+
+public:
+	explicit replayer_t(Library& lib): lib{lib} {}
+
+	bool decode(trace_reader_t& reader, call_t& call)
+	{
+		if (call.op == op_t::read_int_col || call.op == op_t::read_int_row)
+			return decode_bulk(reader, lookup<bulk_fn>(call.op), call);
+		if (call.op == op_t::table_ready)
+			return decode_ready(reader, lookup<ready_fn>(call.op), call);
+		if (call.op == op_t::table_matvec)
+			return decode_matvec(reader, lookup<matvec_fn>(call.op), call);
+		if (call.op == op_t::table_mlp_eval)
+			return decode_mlp(reader, lookup<mlp_fn>(call.op), call);
+		switch (call.op) {
+#define TABLE_TRACE_CASE(name, ...)                                                  \
+	case op_t::name:                                                                 \
+		return decoder<__VA_ARGS__>::decode(                                         \
+			reader, lookup<std::add_pointer_t<__VA_ARGS__>>(call.op), call);
+			TABLE_TRACE_OPS(TABLE_TRACE_CASE)
+#undef TABLE_TRACE_CASE
+		default: return false;
+		}
+	}
+};
+
+static std::vector<char> read_file(const char* path)
+{
+	auto is = std::ifstream{path, std::ios::binary};
+	if (!is)
+		throw std::runtime_error(std::string{"failed to open "} + path);
+	return {std::istreambuf_iterator<char>{is}, std::istreambuf_iterator<char>{}};
+}
+
+static std::vector<call_t> decode_trace(const std::vector<char>& trace, replayer_t& replayer)
+{
+	if (trace.size() < trace_magic.size() ||
+		std::string_view{trace.data(), trace_magic.size()} != trace_magic)
+		throw std::runtime_error("not a libtable trace");
+	auto chunks = trace_reader_t{trace.data() + trace_magic.size(), trace.data() + trace.size()};
+	auto tick_ns = 0.0;
+	auto epoch = std::int64_t{};
+	if (!chunks.get(tick_ns) || !chunks.get(epoch) || !(tick_ns > 0))
+		throw std::runtime_error("corrupt trace header");
+	const auto to_ns = [tick_ns](std::int64_t ticks) -> std::int64_t {
+		return std::llround(static_cast<double>(ticks) * tick_ns);
+	};
+	auto calls = std::vector<call_t>{};
+	while (!chunks.empty()) {
+		auto thread = std::uint32_t{};
+		auto size = std::uint32_t{};
+		if (!chunks.get(thread) || !chunks.get(size))
+			throw std::runtime_error("truncated chunk header");
+		const char* payload = nullptr;
+		if (!chunks.get(payload, size))
+			throw std::runtime_error("truncated chunk");
+		auto reader = trace_reader_t{payload, payload + size};
+		while (!reader.empty()) {
+			auto op = op_t::none;
+			auto start = std::int64_t{};
+			auto duration = std::int64_t{};
+			if (!reader.get(op) || !reader.get(start) || !reader.get(duration) ||
+				op == op_t::none || op >= op_t::count)
+				throw std::runtime_error("corrupt record in thread " + std::to_string(thread));
+			auto& call = calls.emplace_back(call_t{op, to_ns(start - epoch), to_ns(duration), {}});
+			if (!replayer.decode(reader, call))
+				throw std::runtime_error("corrupt arguments of " +
+										 std::string{op_names[static_cast<size_t>(call.op)]});
+		}
+	}
+	std::stable_sort(calls.begin(), calls.end(),
+					 [](const call_t& a, const call_t& b) { return a.start < b.start; });
+	return calls;
+}
+
+/** Waits until the deadline: sleeps while it is far and spins for the last bit */
+static void wait_until(trace_clock::time_point deadline)
+{
+	constexpr auto spin = std::chrono::microseconds{200};
+	auto now = trace_clock::now();
+	if (deadline - now > spin)
+		std::this_thread::sleep_until(deadline - spin);
+	while (trace_clock::now() < deadline)
+		;
+}
+
+static void print_stats(std::ostream& os, const std::array<stats_t, op_count>& stats)
+{
+	os << std::left << std::setw(24) << "function" << std::right << std::setw(10) << "calls"
+	   << std::setw(12) << "mismatches" << std::setw(14) << "recorded,ns" << std::setw(14)
+	   << "replayed,ns" << '\n';
+	for (auto i = size_t{1}; i < op_count; ++i) {
+		const auto& s = stats[i];
+		if (s.calls == 0)
+			continue;
+		const auto n = static_cast<std::int64_t>(s.calls);
+		os << std::left << std::setw(24) << op_names[i] << std::right << std::setw(10) << s.calls
+		   << std::setw(12) << s.mismatches << std::setw(14) << s.recorded / n << std::setw(14)
+		   << s.replayed / n << '\n';
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	auto timed = false;
+	auto verbose = false;
+	auto paths = std::vector<const char*>{};
+	for (auto i = 1; i < argc; ++i) {
+		const auto arg = std::string_view{argv[i]};
+		if (arg == "--timed")
+			timed = true;
+		else if (arg == "--verbose")
+			verbose = true;
+		else
+			paths.push_back(argv[i]);
+	}
+	if (paths.size() != 2) {
+		std::cerr << "Usage: " << argv[0] << " [--timed] [--verbose] library trace\n"
+				  << "  --timed    follow the recorded timing instead of replaying at full speed\n"
+				  << "  --verbose  report each mismatching call\n";
+		return 2;
+	}
+	try {
+		auto lib = Library{paths[0]};
+		auto replayer = replayer_t{lib};
+		const auto calls = decode_trace(read_file(paths[1]), replayer);
+		auto stats = std::array<stats_t, op_count>{};
+		auto mismatches = size_t{0};
+		const auto replay_start = trace_clock::now();
+		const auto trace_start = calls.empty() ? std::int64_t{0} : calls.front().start;
+		for (auto i = size_t{0}; i < calls.size(); ++i) {
+			const auto& call = calls[i];
+			if (timed)
+				wait_until(replay_start + std::chrono::nanoseconds{call.start - trace_start});
+			const auto start = trace_clock::now();
+			const auto match = call.replay();
+			const auto finish = trace_clock::now();
+			auto& s = stats[static_cast<size_t>(call.op)];
+			++s.calls;
+			s.recorded += call.duration;
+			s.replayed +=
+				std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+			if (!match) {
+				++s.mismatches;
+				++mismatches;
+				if (verbose)
+					std::cerr << "call " << i << " " << op_names[static_cast<size_t>(call.op)]
+							  << " result differs from the recording\n";
+			}
+		}
+		const auto total = trace_clock::now() - replay_start;
+		print_stats(std::cout, stats);
+		std::cout << calls.size() << " calls replayed in "
+				  << std::chrono::duration_cast<std::chrono::microseconds>(total).count()
+				  << "us, " << mismatches << " mismatches\n";
+		return (mismatches == 0) ? 0 : 1;
+	} catch (std::exception& e) {
+		std::cerr << "Failed: " << e.what() << std::endl;
+		return 2;
+	}
+}
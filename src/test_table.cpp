@@ -3,36 +3,18 @@
  * Author: Marius Mikucionis <marius@cs.aau.dk>
  */
 #include "library.hpp"
+#include "test_table.hpp"
 
 #include <doctest/doctest.h>
 
 #include <vector>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
-
-#if defined(__linux__)
-const auto table_path = std::filesystem::current_path() / "libtable.so";
-#elif defined(__APPLE__)
-const auto table_path = std::filesystem::current_path() / "libtable.dylib";
-#elif defined(__MINGW32__)
-const auto table_path = std::filesystem::current_path() / "libtable.dll";
-#elif defined(_WIN32)
-const auto table_path = [] {
-	// CMake on Windows puts Release binaries into CMAKE_CURRENT_BINARY_DIR/Release
-	// otherwise binaries are in CMAKE_CURRENT_BINARY_DIR
-	auto buffer = std::string(1024, '\0');
-	auto size = GetModuleFileNameA(
-		NULL, buffer.data(), static_cast<DWORD>(buffer.size()));  // path to current executable
-	while (size >= buffer.size()) {
-		buffer.resize(buffer.size() * 2, '\0');
-		size = GetModuleFileNameA(NULL, buffer.data(), static_cast<DWORD>(buffer.size()));
-	}
-	buffer.resize(size);  // truncate the path
-	return std::filesystem::path{buffer}.parent_path() / "table.dll";
-}();
-#else
-#error("Unknown platform")
-#endif
+#include <cmath>   // isnan
+#include <limits>  // numeric_limits
+#include <string>
+#include <thread>  // yield
 
 TEST_CASE("load libtable")
 {
@@ -130,3 +112,614 @@ TEST_CASE("load libtable")
 		CHECK(false);
 	}
 }
+
+TEST_CASE("out of range access")
+{
+	using fn_void_to_int = int (*)();
+	using fn_int_int_double_to_int = int (*)(int, int, double);
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+	using fn_int_int_int_to_double = double (*)(int, int, int);
+	using fn_int_int_int_double = void (*)(int, int, int, double);
+	using fn_int_int_int_intp_int_int = void (*)(int, int, int, int*, int, int);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_new_double = lib.lookup<fn_int_int_double_to_int>("table_new_double");
+		auto read_int = lib.lookup<fn_int_int_int_to_int>("read_int");
+		auto read_double = lib.lookup<fn_int_int_int_to_double>("read_double");
+		auto write_double = lib.lookup<fn_int_int_int_double>("write_double");
+		auto read_int_row = lib.lookup<fn_int_int_int_intp_int_int>("read_int_row");
+		auto table_last_error = lib.lookup<fn_void_to_int>("table_last_error");
+		auto table_error_count = lib.lookup<fn_void_to_int>("table_error_count");
+
+		const auto id = table_new_double(2, 3, 1.5);
+		REQUIRE(id >= 0);
+		const auto errors = table_error_count();
+		CHECK(read_double(id, 1, 2) == 1.5);
+		CHECK(table_error_count() == errors);
+
+		CHECK(std::isnan(read_double(id + 1000, 0, 0)));
+		CHECK(table_last_error() == 1);
+		CHECK(std::isnan(read_double(id, 2, 0)));
+		CHECK(table_last_error() == 2);
+		CHECK(std::isnan(read_double(id, 0, -1)));
+		CHECK(table_last_error() == 3);
+		CHECK(read_int(id, -1, 0) == std::numeric_limits<int>::min());
+		CHECK(table_last_error() == 2);
+		write_double(id, 0, 3, 2.0);
+		CHECK(table_last_error() == 3);
+		CHECK(table_error_count() == errors + 5);
+
+		auto row = std::vector<int>(4, 7);
+		read_int_row(id, 0, 1, row.data(), 0, 3);  // one column too many
+		CHECK(table_last_error() == 3);
+		CHECK(row[0] == 7);	 // nothing is written on error
+		read_int_row(id, 0, 1, row.data(), 1, 2);
+		CHECK(row[0] == 7);
+		CHECK(row[1] == 1);
+		CHECK(row[2] == 1);
+		CHECK(table_new_double(-1, 2, 0.0) == -1);
+		CHECK(table_last_error() == 4);
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("checkpoint and rollback")
+{
+	using fn_int_to_int = int (*)(int);
+	using fn_int_int_to_int = int (*)(int, int);
+	using fn_int_int_double_to_int = int (*)(int, int, double);
+	using fn_int_int_int_to_double = double (*)(int, int, int);
+	using fn_int_int_int_double = void (*)(int, int, int, double);
+	using fn_int_int_int_double_to_int = int (*)(int, int, int, double);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_new_double = lib.lookup<fn_int_int_double_to_int>("table_new_double");
+		auto table_resize_double = lib.lookup<fn_int_int_int_double_to_int>("table_resize_double");
+		auto table_rows = lib.lookup<fn_int_to_int>("table_rows");
+		auto table_cols = lib.lookup<fn_int_to_int>("table_cols");
+		auto table_clear = lib.lookup<fn_int_to_int>("table_clear");
+		auto read_double = lib.lookup<fn_int_int_int_to_double>("read_double");
+		auto write_double = lib.lookup<fn_int_int_int_double>("write_double");
+		auto table_checkpoint = lib.lookup<fn_int_to_int>("table_checkpoint");
+		auto table_rollback = lib.lookup<fn_int_int_to_int>("table_rollback");
+		auto table_release = lib.lookup<fn_int_int_to_int>("table_release");
+		auto table_last_error = lib.lookup<int (*)()>("table_last_error");
+
+		const auto id = table_new_double(3, 3, 0.0);
+		REQUIRE(id >= 0);
+		write_double(id, 1, 1, 1.0);
+		const auto outer = table_checkpoint(id);
+		REQUIRE(outer >= 0);
+		write_double(id, 1, 1, 2.0);
+		write_double(id, 2, 2, 3.0);
+		const auto inner = table_checkpoint(id);
+		REQUIRE(inner > outer);
+		table_resize_double(id, 2, 5, 4.0);
+		CHECK(table_rows(id) == 2);
+		CHECK(read_double(id, 0, 4) == 4.0);
+		write_double(id, 0, 0, 5.0);
+
+		CHECK(table_rollback(id, inner) == id);  // undo the resize and the last write
+		CHECK(table_rows(id) == 3);
+		CHECK(table_cols(id) == 3);
+		CHECK(read_double(id, 0, 0) == 0.0);
+		CHECK(read_double(id, 1, 1) == 2.0);
+		CHECK(read_double(id, 2, 2) == 3.0);
+
+		table_clear(id);
+		CHECK(table_rows(id) == 0);
+		CHECK(table_rollback(id, inner) == id);	 // the same checkpoint can be reused
+		CHECK(read_double(id, 2, 2) == 3.0);
+
+		CHECK(table_rollback(id, outer) == id);
+		CHECK(read_double(id, 1, 1) == 1.0);
+		CHECK(read_double(id, 2, 2) == 0.0);
+		CHECK(table_rollback(id, inner) == -1);	 // nested checkpoint is gone
+		const auto newer = table_checkpoint(id);
+		CHECK(newer != inner);
+		write_double(id, 0, 0, 5.0);
+		CHECK(table_rollback(id, inner) == -1);	 // stale token is not taken for the newer one
+		CHECK(table_last_error() == 7);
+		CHECK(read_double(id, 0, 0) == 5.0);
+
+		write_double(id, 0, 0, 6.0);
+		CHECK(table_release(id, outer) == id);
+		CHECK(read_double(id, 0, 0) == 6.0);  // modifications are kept
+		CHECK(table_rollback(id, outer) == -1);
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("trace recording")
+{
+	using fn_void_to_int = int (*)();
+	using fn_str_to_int = int (*)(const char*);
+	using fn_int_int_double_to_int = int (*)(int, int, double);
+	using fn_int_int_int_to_double = double (*)(int, int, int);
+	using fn_int_int_int_double = void (*)(int, int, int, double);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_trace_start = lib.lookup<fn_str_to_int>("table_trace_start");
+		auto table_trace_stop = lib.lookup<fn_void_to_int>("table_trace_stop");
+		auto table_new_double = lib.lookup<fn_int_int_double_to_int>("table_new_double");
+		auto read_double = lib.lookup<fn_int_int_int_to_double>("read_double");
+		auto write_double = lib.lookup<fn_int_int_int_double>("write_double");
+
+		REQUIRE(table_trace_start("test_table.trace") == 0);
+		const auto id = table_new_double(2, 2, 0.5);
+		write_double(id, 1, 1, 1.5);
+		CHECK(read_double(id, 1, 1) == 1.5);
+		CHECK(table_trace_stop() == 0);
+
+		auto is = std::ifstream{"test_table.trace", std::ios::binary};
+		REQUIRE(static_cast<bool>(is));
+		const auto trace =
+			std::string{std::istreambuf_iterator<char>{is}, std::istreambuf_iterator<char>{}};
+		CHECK(trace.substr(0, 8) == "UTBTRC03");
+		// header, chunk header and three records of op, start and duration with arguments:
+		CHECK(trace.size() == 24 + 8 + (17 + 16 + 4) + (17 + 20) + (17 + 20));
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("sampling from weighted values")
+{
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+	using fn_int_int_double_to_int = int (*)(int, int, double);
+	using fn_int_int_int_double = void (*)(int, int, int, double);
+	using fn_int_double_double_to_double = double (*)(int, double, double);
+	using fn_int_double_to_double = double (*)(int, double);
+
+	auto approx = doctest::Approx{0}.epsilon(0.00001);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_new_double = lib.lookup<fn_int_int_double_to_int>("table_new_double");
+		auto write_double = lib.lookup<fn_int_int_int_double>("write_double");
+		auto table_sampler_build = lib.lookup<fn_int_int_int_to_int>("table_sampler_build");
+		auto table_sample = lib.lookup<fn_int_double_double_to_double>("table_sample");
+		auto table_sample_continuous =
+			lib.lookup<fn_int_double_to_double>("table_sample_continuous");
+
+		// values 3, 1, 2 with weights 3, 1, 0 (unsorted):
+		const auto id = table_new_double(3, 2, 0.0);
+		write_double(id, 0, 0, 3.0);
+		write_double(id, 0, 1, 3.0);
+		write_double(id, 1, 0, 1.0);
+		write_double(id, 1, 1, 1.0);
+		write_double(id, 2, 0, 2.0);
+		const auto sampler = table_sampler_build(id, 0, 1);
+		REQUIRE(sampler >= 0);
+		constexpr auto steps1 = 300;  // a multiple of the number of values
+		constexpr auto steps2 = 200;
+		auto counts = std::vector<int>(4, 0);
+		for (auto i = 0; i < steps1; ++i)
+			for (auto j = 0; j < steps2; ++j) {
+				const auto v = table_sample(sampler, (i + 0.5) / steps1, (j + 0.5) / steps2);
+				REQUIRE(v >= 1.0);
+				REQUIRE(v <= 3.0);
+				++counts[static_cast<size_t>(v)];
+			}
+		CHECK(counts[1] == steps1 * steps2 / 4);
+		CHECK(counts[2] == 0);
+		CHECK(counts[3] == steps1 * steps2 * 3 / 4);
+
+		// cumulative weights at values 1, 2, 3 are 0.25, 0.25, 1.0:
+		CHECK(table_sample_continuous(sampler, 0.0) == 1.0);
+		CHECK(table_sample_continuous(sampler, 0.25) == 1.0);
+		CHECK(table_sample_continuous(sampler, 0.5) == approx(7.0 / 3));
+		CHECK(table_sample_continuous(sampler, 1.0) == 3.0);
+
+		CHECK(table_sampler_build(id, 0, 2) == -1);	 // no such column
+		write_double(id, 2, 1, -1.0);
+		CHECK(table_sampler_build(id, 0, 1) == -1);	 // negative weight
+		CHECK(std::isnan(table_sample(sampler + 1000, 0.5, 0.5)));
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("sparse tables")
+{
+	using fn_int_to_int = int (*)(int);
+	using fn_int_int_to_int = int (*)(int, int);
+	using fn_int_str_to_int = int (*)(int, const char*);
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+	using fn_int_int_int_to_double = double (*)(int, int, int);
+	using fn_int_int_int_int = void (*)(int, int, int, int);
+	using fn_int_int_int_int_to_int = int (*)(int, int, int, int);
+	using fn_int_double_int_int_to_double = double (*)(int, double, int, int);
+	using fn_int_int_int_intp_int_int = void (*)(int, int, int, int*, int, int);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_new_int = lib.lookup<fn_int_int_int_to_int>("table_new_int");
+		auto table_new_sparse_int = lib.lookup<fn_int_int_int_to_int>("table_new_sparse_int");
+		auto table_is_sparse = lib.lookup<fn_int_to_int>("table_is_sparse");
+		auto table_rows = lib.lookup<fn_int_to_int>("table_rows");
+		auto table_cols = lib.lookup<fn_int_to_int>("table_cols");
+		auto table_resize_int = lib.lookup<fn_int_int_int_int_to_int>("table_resize_int");
+		auto table_write_csv = lib.lookup<fn_int_str_to_int>("table_write_csv");
+		auto table_copy = lib.lookup<fn_int_to_int>("table_copy");
+		auto read_int = lib.lookup<fn_int_int_int_to_int>("read_int");
+		auto read_double = lib.lookup<fn_int_int_int_to_double>("read_double");
+		auto write_int = lib.lookup<fn_int_int_int_int>("write_int");
+		auto read_int_col = lib.lookup<fn_int_int_int_intp_int_int>("read_int_col");
+		auto read_int_row = lib.lookup<fn_int_int_int_intp_int_int>("read_int_row");
+		auto interpolate = lib.lookup<fn_int_double_int_int_to_double>("interpolate");
+		auto table_checkpoint = lib.lookup<fn_int_to_int>("table_checkpoint");
+		auto table_rollback = lib.lookup<fn_int_int_to_int>("table_rollback");
+		auto table_release = lib.lookup<fn_int_int_to_int>("table_release");
+
+		// ten billion cells do not fit into memory unless sparse:
+		const auto big = table_new_int(100000, 100000, 7);
+		REQUIRE(big >= 0);
+		CHECK(table_is_sparse(big) == 1);
+		CHECK(table_rows(big) == 100000);
+		CHECK(table_cols(big) == 100000);
+		CHECK(read_int(big, 99999, 99999) == 7);
+		write_int(big, 12345, 67890, 42);
+		CHECK(read_int(big, 12345, 67890) == 42);
+		CHECK(std::isnan(read_double(big, 100000, 0)));
+		auto column = std::vector<int>(3, 0);
+		read_int_col(big, 12344, 67890, column.data(), 0, 3);
+		CHECK(column == std::vector<int>{7, 42, 7});
+		const auto copy = table_copy(big);
+		CHECK(table_is_sparse(copy) == 1);
+		CHECK(read_int(copy, 12345, 67890) == 42);
+		CHECK(table_is_sparse(table_new_int(10, 10, 0)) == 0);
+
+		const auto id = table_new_sparse_int(3, 8, 0);
+		CHECK(table_is_sparse(id) == 1);
+		write_int(id, 0, 0, 1);
+		write_int(id, 1, 0, 2);
+		write_int(id, 2, 0, 3);
+		write_int(id, 1, 1, 5);
+		write_int(id, 2, 1, 9);
+		CHECK(interpolate(id, 1.5, 0, 1) == 2.5);
+		auto row = std::vector<int>(4, 0);
+		read_int_row(id, 1, 0, row.data(), 0, 4);
+		CHECK(row == std::vector<int>{2, 5, 0, 0});
+		CHECK(table_write_csv(id, "test_sparse.csv") == 3);
+		auto is = std::ifstream{"test_sparse.csv"};
+		const auto csv = std::string{std::istreambuf_iterator<char>{is}, {}};
+		CHECK(csv == "1,0,0,0,0,0,0,0\n2,5,0,0,0,0,0,0\n3,9,0,0,0,0,0,0\n");
+
+		const auto token = table_checkpoint(id);
+		table_resize_int(id, 2, 2, 0);
+		CHECK(table_is_sparse(id) == 1);
+		CHECK(read_int(id, 1, 1) == 5);
+		write_int(id, 0, 1, 4);	 // more than a quarter of cells are written
+		CHECK(table_is_sparse(id) == 0);
+		CHECK(table_rollback(id, token) == id);
+		CHECK(table_rows(id) == 3);
+		CHECK(table_cols(id) == 8);
+		CHECK(read_int(id, 0, 1) == 0);
+		CHECK(read_int(id, 2, 1) == 9);
+		CHECK(read_int(id, 2, 7) == 0);
+
+		// rolling back a reshape into dense restores the sparse table without expanding it:
+		const auto undo = table_checkpoint(big);
+		CHECK(table_resize_int(big, 10, 10, 0) == big);
+		CHECK(table_is_sparse(big) == 0);
+		write_int(big, 1, 1, 3);
+		CHECK(table_rollback(big, undo) == big);
+		CHECK(table_is_sparse(big) == 1);
+		CHECK(table_rows(big) == 100000);
+		CHECK(table_cols(big) == 100000);
+		CHECK(read_int(big, 1, 1) == 7);
+		CHECK(read_int(big, 12345, 67890) == 42);
+		CHECK(read_int(big, 99999, 99999) == 7);
+		CHECK(table_release(big, undo) == big);
+
+		// a sparse table becomes dense at the new size, without expanding the old one:
+		write_int(copy, 1, 2, 3);
+		CHECK(table_resize_int(copy, 10, 10, 0) == copy);
+		CHECK(table_is_sparse(copy) == 0);
+		CHECK(read_int(copy, 1, 2) == 3);
+		CHECK(read_int(copy, 9, 9) == 7);
+		const auto grown = table_new_sparse_int(2, 2, 7);
+		write_int(grown, 0, 1, 1);
+		CHECK(table_resize_int(grown, 3, 3, 0) == grown);
+		row.resize(3);
+		read_int_row(grown, 0, 0, row.data(), 0, 3);
+		CHECK(row == std::vector<int>{7, 1, 0});
+		read_int_row(grown, 2, 0, row.data(), 0, 3);
+		CHECK(row == std::vector<int>{0, 0, 0});
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("background loading")
+{
+	using fn_int_to_int = int (*)(int);
+	using fn_str_int_to_int = int (*)(const char*, int);
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_read_csv = lib.lookup<fn_str_int_to_int>("table_read_csv");
+		auto table_read_csv_async = lib.lookup<fn_str_int_to_int>("table_read_csv_async");
+		auto table_ready = lib.lookup<fn_int_to_int>("table_ready");
+		auto table_rows = lib.lookup<fn_int_to_int>("table_rows");
+		auto table_cols = lib.lookup<fn_int_to_int>("table_cols");
+		auto read_int = lib.lookup<fn_int_int_int_to_int>("read_int");
+		auto table_last_error = lib.lookup<int (*)()>("table_last_error");
+
+		constexpr auto files = 4;
+		constexpr auto rows = 2000;
+		constexpr auto cols = 10;
+		for (auto f = 0; f < files; ++f) {
+			auto os = std::ofstream{"test_async" + std::to_string(f) + ".csv"};
+			os << "#header\n";
+			for (auto r = 0; r < rows; ++r) {
+				for (auto c = 0; c < cols; ++c)
+					os << (c > 0 ? "," : "") << f * rows * cols + r * cols + c;
+				os << '\n';
+			}
+		}
+		auto ids = std::vector<int>{};
+		for (auto f = 0; f < files; ++f) {
+			const auto path = "test_async" + std::to_string(f) + ".csv";
+			ids.push_back(table_read_csv_async(path.c_str(), 0));
+		}
+		const auto missing = table_read_csv_async("test_async_missing.csv", 0);
+		for (auto id : ids)
+			REQUIRE(id >= 0);
+		REQUIRE(missing >= 0);
+
+		// the first access waits for the table:
+		CHECK(table_rows(ids[2]) == rows);
+		CHECK(table_ready(ids[2]) == 1);
+		CHECK(read_int(ids[2], rows - 1, cols - 1) == 3 * rows * cols - 1);
+		// polling:
+		while (table_ready(ids[0]) == 0)
+			std::this_thread::yield();
+		CHECK(table_ready(ids[0]) == 1);
+		CHECK(table_cols(ids[0]) == cols);
+		CHECK(read_int(ids[0], 1, 2) == 12);
+		// the same content as loaded synchronously:
+		const auto sync = table_read_csv("test_async3.csv", 0);
+		for (auto r = 0; r < rows; r += 97)
+			CHECK(read_int(sync, r, 5) == read_int(ids[3], r, 5));
+		// failures show up when the table becomes ready:
+		while (table_ready(missing) == 0)
+			std::this_thread::yield();
+		CHECK(table_ready(missing) == -1);
+		CHECK(table_rows(missing) == 0);
+		CHECK(table_ready(-1) == -1);
+		CHECK(table_last_error() == 1);
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("matrix-vector products and perceptrons")
+{
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+	using fn_int_int_int_double = void (*)(int, int, int, double);
+	using fn_matvec = int (*)(int, const double*, int, double*, int);
+	using fn_mlp = int (*)(const int*, const int*, int, const double*, int, double*, int);
+
+	auto approx = doctest::Approx{0}.epsilon(1e-12);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_new_int = lib.lookup<fn_int_int_int_to_int>("table_new_int");
+		auto table_new_sparse_int = lib.lookup<fn_int_int_int_to_int>("table_new_sparse_int");
+		auto write_double = lib.lookup<fn_int_int_int_double>("write_double");
+		auto table_matvec = lib.lookup<fn_matvec>("table_matvec");
+		auto table_mlp_eval = lib.lookup<fn_mlp>("table_mlp_eval");
+		auto table_last_error = lib.lookup<int (*)()>("table_last_error");
+
+		// odd sizes exercise the remainders of the 4x4 blocks:
+		constexpr auto rows = 7;
+		constexpr auto cols = 2053;
+		const auto w = table_new_int(rows, cols, 0);
+		const auto weight = [](int r, int c) { return std::sin(r * 0.7 + c * 0.013); };
+		for (auto r = 0; r < rows; ++r)
+			for (auto c = 0; c < cols; ++c)
+				write_double(w, r, c, weight(r, c));
+		auto in = std::vector<double>(cols);
+		for (auto c = 0; c < cols; ++c)
+			in[c] = std::cos(c * 0.1);
+		auto out = std::vector<double>(rows, -1);
+		CHECK(table_matvec(w, in.data(), cols, out.data(), rows) == rows);
+		for (auto r = 0; r < rows; ++r) {
+			auto expected = 0.0;
+			for (auto c = 0; c < cols; ++c)
+				expected += weight(r, c) * in[c];
+			CHECK(out[r] == approx(expected));
+		}
+		CHECK(table_matvec(w, in.data(), cols - 1, out.data(), rows) == -1);
+		CHECK(table_last_error() == 9);
+		CHECK(table_matvec(w, nullptr, cols, out.data(), rows) == -1);
+		CHECK(table_last_error() == 4);
+
+		// rotation by 90 degrees in place:
+		const auto rot = table_new_int(2, 2, 0);
+		write_double(rot, 0, 1, -1);
+		write_double(rot, 1, 0, 1);
+		auto v = std::vector<double>{3, 4};
+		CHECK(table_matvec(rot, v.data(), 2, v.data(), 2) == 2);
+		CHECK(v == std::vector<double>{-4, 3});
+
+		// sparse tables contribute the fill value and the stored cells:
+		const auto s = table_new_sparse_int(3, 100, 2);
+		write_double(s, 1, 50, 5);
+		auto ones = std::vector<double>(100, 1.0);
+		auto res = std::vector<double>(3);
+		CHECK(table_matvec(s, ones.data(), 100, res.data(), 3) == 3);
+		CHECK(res == std::vector<double>{200, 203, 200});
+
+		// 2 inputs -> 3 hidden (ReLU) -> 1 output (tanh), biases in the last column:
+		const auto hidden = table_new_int(3, 3, 0);
+		const double h[3][3] = {{1, 2, 0.5}, {-1, 1, 0}, {0.5, -2, -1}};
+		for (auto r = 0; r < 3; ++r)
+			for (auto c = 0; c < 3; ++c)
+				write_double(hidden, r, c, h[r][c]);
+		const auto output = table_new_int(1, 4, 0);
+		const double o[4] = {0.3, -0.2, 0.1, 0.05};
+		for (auto c = 0; c < 4; ++c)
+			write_double(output, 0, c, o[c]);
+		const int layers[2] = {hidden, output};
+		const int activations[2] = {1, 2};
+		const double x[2] = {0.5, -0.25};
+		auto y = 0.0;
+		CHECK(table_mlp_eval(layers, activations, 2, x, 2, &y, 1) == 1);
+		auto expected = o[3];
+		for (auto r = 0; r < 3; ++r)
+			expected += o[r] * std::max(0.0, h[r][0] * x[0] + h[r][1] * x[1] + h[r][2]);
+		CHECK(y == approx(std::tanh(expected)));
+		CHECK(table_mlp_eval(layers, activations, 2, x, 2, &y, 2) == -1);
+		CHECK(table_last_error() == 9);
+		const int unknown[2] = {1, 3};
+		CHECK(table_mlp_eval(layers, unknown, 2, x, 2, &y, 1) == -1);
+		CHECK(table_last_error() == 10);
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
+
+TEST_CASE("memory accounting")
+{
+	using fn_int_to_int = int (*)(int);
+	using fn_int_to_double = double (*)(int);
+	using fn_int_int_to_int = int (*)(int, int);
+	using fn_str_int_to_int = int (*)(const char*, int);
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+	using fn_int_int_int_int = void (*)(int, int, int, int);
+	using fn_int_int_int_int_to_int = int (*)(int, int, int, int);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_new_int = lib.lookup<fn_int_int_int_to_int>("table_new_int");
+		auto table_new_sparse_int = lib.lookup<fn_int_int_int_to_int>("table_new_sparse_int");
+		auto table_read_csv = lib.lookup<fn_str_int_to_int>("table_read_csv");
+		auto table_resize_int = lib.lookup<fn_int_int_int_int_to_int>("table_resize_int");
+		auto table_copy = lib.lookup<fn_int_to_int>("table_copy");
+		auto table_clear = lib.lookup<fn_int_to_int>("table_clear");
+		auto table_rows = lib.lookup<fn_int_to_int>("table_rows");
+		auto read_int = lib.lookup<fn_int_int_int_to_int>("read_int");
+		auto write_int = lib.lookup<fn_int_int_int_int>("write_int");
+		auto table_checkpoint = lib.lookup<fn_int_to_int>("table_checkpoint");
+		auto table_release = lib.lookup<fn_int_int_to_int>("table_release");
+		auto table_memory_bytes = lib.lookup<fn_int_to_double>("table_memory_bytes");
+		auto table_memory_total = lib.lookup<double (*)()>("table_memory_total");
+		auto table_set_memory_limit = lib.lookup<int (*)(double)>("table_set_memory_limit");
+		auto table_last_error = lib.lookup<int (*)()>("table_last_error");
+		auto table_is_sparse = lib.lookup<fn_int_to_int>("table_is_sparse");
+		auto table_sampler_build = lib.lookup<fn_int_int_int_to_int>("table_sampler_build");
+
+		const auto initial = table_memory_total();
+		const auto id = table_new_int(100, 100, 1);
+		const auto bytes = table_memory_bytes(id);
+		CHECK(bytes >= 100 * 100 * sizeof(double));
+		CHECK(table_memory_total() == initial + bytes);
+		CHECK(table_memory_bytes(-1) == -1);
+
+		// the journal is accounted to the table:
+		const auto token = table_checkpoint(id);
+		for (auto c = 0; c < 100; ++c)
+			write_int(id, 0, c, 2);
+		CHECK(table_memory_bytes(id) >= bytes + 100 * (2 * sizeof(int) + sizeof(double)));
+		CHECK(table_release(id, token) == id);
+		CHECK(table_memory_bytes(id) == bytes);
+
+		// allocations beyond the limit fail without side effects:
+		CHECK(table_set_memory_limit(table_memory_total() + 1000) == 0);
+		CHECK(table_new_int(100, 100, 0) == -1);
+		CHECK(table_last_error() == 11);
+		CHECK(table_copy(id) == -1);
+		CHECK(table_resize_int(id, 200, 100, 0) == -1);
+		CHECK(table_rows(id) == 100);
+		CHECK(read_int(id, 99, 99) == 1);
+		CHECK(table_resize_int(id, 50, 100, 0) == id);	// shrinking is fine
+		CHECK(table_set_memory_limit(table_memory_total()) == 0);
+		CHECK(table_read_csv("table_input.csv", 0) == -1);
+		const auto sparse = table_new_sparse_int(1000, 1000, 0);
+		REQUIRE(sparse >= 0);
+		write_int(sparse, 1, 1, 5);
+		CHECK(read_int(sparse, 1, 1) == 0);	 // the write is dropped
+		CHECK(table_last_error() == 11);
+
+		// releasing memory makes room again:
+		CHECK(table_clear(id) == id);
+		CHECK(table_memory_bytes(id) == 0);
+		write_int(sparse, 1, 1, 5);
+		CHECK(read_int(sparse, 1, 1) == 5);
+		CHECK(table_set_memory_limit(0) == 0);
+		CHECK(table_new_int(100, 100, 0) >= 0);
+
+		// the cells copied into the journal, densified tables and samplers are checked up front:
+		const auto journaled = table_new_int(100, 100, 1);
+		const auto undo = table_checkpoint(journaled);
+		const auto small = table_new_sparse_int(10, 10, 0);
+		for (auto c = 0; c < 25; ++c)
+			write_int(small, c / 10, c % 10, 1);
+		CHECK(table_set_memory_limit(table_memory_total() + 1000) == 0);
+		write_int(small, 9, 9, 1);	// the 26th cell would make the table dense
+		CHECK(table_is_sparse(small) == 1);
+		CHECK(read_int(small, 9, 9) == 0);
+		CHECK(table_last_error() == 11);
+		CHECK(table_clear(journaled) == -1);
+		CHECK(table_last_error() == 11);
+		CHECK(table_resize_int(journaled, 10, 10, 1) == -1);
+		CHECK(table_rows(journaled) == 100);
+		CHECK(read_int(journaled, 99, 99) == 1);
+		CHECK(table_sampler_build(journaled, 0, 1) == -1);
+		CHECK(table_last_error() == 11);
+		CHECK(table_set_memory_limit(0) == 0);
+		CHECK(table_clear(journaled) == journaled);
+		CHECK(table_release(journaled, undo) == journaled);
+		write_int(small, 9, 9, 1);
+		CHECK(table_is_sparse(small) == 0);
+
+		// growing the full journal log or the buckets of a sparse table is checked too:
+		const auto logged = table_new_int(100, 100, 0);
+		const auto mark = table_checkpoint(logged);
+		for (auto i = 0; i < 1024; ++i)	 // fills the log up to its capacity
+			write_int(logged, i / 100, i % 100, 1);
+		CHECK(table_set_memory_limit(table_memory_total() + 1000) == 0);
+		write_int(logged, 20, 0, 1);  // the log would double
+		CHECK(read_int(logged, 20, 0) == 0);
+		CHECK(table_last_error() == 11);
+		CHECK(table_set_memory_limit(0) == 0);
+		CHECK(table_release(logged, mark) == logged);
+		const auto map = table_new_sparse_int(1000, 1000, 0);
+		auto rejected = false;
+		for (auto c = 0; c < 100 && !rejected; ++c) {
+			CHECK(table_set_memory_limit(table_memory_total() + 100) == 0);  // a cell fits
+			write_int(map, 0, c, 1);
+			rejected = (read_int(map, 0, c) == 0);
+		}
+		CHECK(rejected);  // the buckets do not fit
+		CHECK(table_last_error() == 11);
+		CHECK(table_set_memory_limit(0) == 0);
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
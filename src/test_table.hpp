@@ -0,0 +1,39 @@
+/**
+ * Location of libtable library for the tests.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#ifndef _TEST_TABLE_HPP_
+#define _TEST_TABLE_HPP_
+
+#include <filesystem>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>  // GetModuleFileNameA
+#endif
+
+#if defined(__linux__)
+const auto table_path = std::filesystem::current_path() / "libtable.so";
+#elif defined(__APPLE__)
+const auto table_path = std::filesystem::current_path() / "libtable.dylib";
+#elif defined(__MINGW32__)
+const auto table_path = std::filesystem::current_path() / "libtable.dll";
+#elif defined(_WIN32)
+const auto table_path = [] {
+	// CMake on Windows puts Release binaries into CMAKE_CURRENT_BINARY_DIR/Release
+	// otherwise binaries are in CMAKE_CURRENT_BINARY_DIR
+	auto buffer = std::string(1024, '\0');
+	auto size = GetModuleFileNameA(
+		NULL, buffer.data(), static_cast<DWORD>(buffer.size()));  // path to current executable
+	while (size >= buffer.size()) {
+		buffer.resize(buffer.size() * 2, '\0');
+		size = GetModuleFileNameA(NULL, buffer.data(), static_cast<DWORD>(buffer.size()));
+	}
+	buffer.resize(size);  // truncate the path
+	return std::filesystem::path{buffer}.parent_path() / "table.dll";
+}();
+#else
+#error("Unknown platform")
+#endif
+
+#endif /* _TEST_TABLE_HPP_ */
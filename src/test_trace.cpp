@@ -0,0 +1,74 @@
+/**
+ * Records a session of libtable calls for table_replay test.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ *
+ * Runs in a separate process, so that the recorded table ids match the ids in the replay.
+ */
+#include "library.hpp"
+#include "test_table.hpp"
+
+#include <doctest/doctest.h>
+
+#include <iostream>
+#include <thread>  // yield
+#include <vector>
+
+TEST_CASE("record a session for replay")
+{
+	using fn_void_to_int = int (*)();
+	using fn_str_to_int = int (*)(const char*);
+	using fn_str_int_to_int = int (*)(const char*, int);
+	using fn_int_to_int = int (*)(int);
+	using fn_int_int_int_to_int = int (*)(int, int, int);
+	using fn_int_int_double_to_int = int (*)(int, int, double);
+	using fn_int_int_int_to_double = double (*)(int, int, int);
+	using fn_int_int_int_double = void (*)(int, int, int, double);
+	using fn_int_int_int_intp_int_int = void (*)(int, int, int, int*, int, int);
+	using fn_matvec = int (*)(int, const double*, int, double*, int);
+	using fn_mlp_eval = int (*)(const int*, const int*, int, const double*, int, double*, int);
+
+	try {
+		auto lib_path_str = table_path.string();
+		auto lib = Library{lib_path_str.c_str()};
+		auto table_trace_start = lib.lookup<fn_str_to_int>("table_trace_start");
+		auto table_trace_stop = lib.lookup<fn_void_to_int>("table_trace_stop");
+		auto table_new_double = lib.lookup<fn_int_int_double_to_int>("table_new_double");
+		auto table_read_csv_async = lib.lookup<fn_str_int_to_int>("table_read_csv_async");
+		auto table_ready = lib.lookup<fn_int_to_int>("table_ready");
+		auto read_int = lib.lookup<fn_int_int_int_to_int>("read_int");
+		auto read_double = lib.lookup<fn_int_int_int_to_double>("read_double");
+		auto write_double = lib.lookup<fn_int_int_int_double>("write_double");
+		auto read_int_col = lib.lookup<fn_int_int_int_intp_int_int>("read_int_col");
+		auto table_matvec = lib.lookup<fn_matvec>("table_matvec");
+		auto table_mlp_eval = lib.lookup<fn_mlp_eval>("table_mlp_eval");
+
+		REQUIRE(table_trace_start("test_trace.trace") == 0);
+		const auto loading = table_read_csv_async("table_input.csv", 0);
+		const auto id = table_new_double(2, 2, 0.5);
+		write_double(id, 0, 1, -1.5);
+		write_double(id, 1, 0, 2.0);
+		CHECK(read_double(id, 0, 1) == -1.5);
+
+		auto column = std::vector<int>(2, 0);
+		read_int_col(id, 0, 0, column.data(), 0, 2);
+		CHECK(column[1] == 2);
+
+		const double in[2] = {1.0, 2.0};
+		double out[2] = {0.0, 0.0};
+		CHECK(table_matvec(id, in, 2, out, 2) == 2);
+		CHECK(out[0] == -2.5);
+		const auto layer = table_new_double(2, 3, 0.25);  // weights and bias
+		const int layers[2] = {layer, layer};
+		const int activations[2] = {1, 0};
+		CHECK(table_mlp_eval(layers, activations, 2, in, 2, out, 2) == 2);
+
+		while (table_ready(loading) == 0)
+			std::this_thread::yield();
+		CHECK(table_ready(loading) == 1);
+		CHECK(read_int(loading, 1, 1) == 6);
+		CHECK(table_trace_stop() == 0);
+	} catch (std::exception& err) {
+		std::cerr << "Failed: " << err.what() << std::endl;
+		CHECK(false);
+	}
+}
@@ -0,0 +1,39 @@
+/**
+ * Unit tests for the pool of worker threads.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#include "workers.hpp"
+
+#include <doctest/doctest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>  // sleep_for
+#include <vector>
+
+TEST_CASE("warm pool starts threads for a burst of jobs")
+{
+	constexpr auto burst = 4;
+	auto pool = worker_pool_t{burst};
+	pool.submit([] { return 0; }).wait();
+	std::this_thread::sleep_for(std::chrono::milliseconds{50});  // let the warm thread go idle
+
+	auto mutex = std::mutex{};
+	auto all_started = std::condition_variable{};
+	auto started = 0;
+	auto job = [&] {
+		auto lock = std::unique_lock{mutex};
+		++started;
+		all_started.notify_all();
+		// the jobs finish only if they run at the same time:
+		return all_started.wait_for(lock, std::chrono::seconds{10},
+									[&] { return started == burst; });
+	};
+	auto results = std::vector<std::future<bool>>{};
+	for (auto i = 0; i < burst; ++i)
+		results.push_back(pool.submit(job));
+	for (auto& result : results)
+		CHECK(result.get());
+}
@@ -0,0 +1,177 @@
+/**
+ * Recording of library calls into a binary trace.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#include "trace.hpp"
+#include "errors.hpp"
+
+#include <algorithm>  // max
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstdio>	// fopen, fwrite, fseek
+#include <cstdlib>	// getenv
+
+std::atomic<bool> trace_on{false};
+std::atomic<unsigned> trace_generation{0};
+thread_local constinit trace_buffer_t trace_local TRACE_TLS{};
+
+static auto trace_mutex = std::mutex{};  // guards the variables below
+static FILE* trace_file = nullptr;
+static auto trace_epoch = trace_clock::now();  // the start of recording
+static auto trace_epoch_ticks = std::int64_t{0};  // the tick count at the start of recording
+static auto trace_threads = 0u;	 // the number of threads seen in this recording
+
+constexpr auto trace_chunk_size = size_t{1} << 16;	// the size of per-thread buffers
+
+/** Writes the chunk of records of one thread. The caller must hold the trace_mutex. */
+static void trace_write(std::uint32_t thread, const char* data, size_t size)
+{
+	if (trace_file == nullptr || size == 0)
+		return;
+	const auto size32 = static_cast<std::uint32_t>(size);
+	std::fwrite(&thread, sizeof(thread), 1, trace_file);
+	std::fwrite(&size32, sizeof(size32), 1, trace_file);
+	std::fwrite(data, 1, size, trace_file);
+}
+
+/** Returns the nanoseconds per tick measured since the start of recording */
+static double trace_tick_ns()
+{
+#ifdef TRACE_TSC
+	const auto ticks = trace_ticks() - trace_epoch_ticks;
+	const auto time = std::chrono::duration<double, std::nano>{trace_clock::now() - trace_epoch};
+	return (ticks > 0) ? time.count() / static_cast<double>(ticks) : 0.0;
+#else
+	return 1.0;
+#endif
+}
+
+/** Per-thread storage of trace_local, flushed when full and when the thread exits */
+struct thread_trace_t
+{
+	std::unique_ptr<char[]> data;
+	size_t capacity = 0;
+	std::uint32_t thread = 0;
+
+	/** Writes out the buffered records. The caller must hold the trace_mutex. */
+	void flush()
+	{
+		trace_write(thread, data.get(), static_cast<size_t>(trace_local.pos - data.get()));
+		trace_local.pos = data.get();
+	}
+
+	/** Writes out the buffered records if the buffer belongs to the current recording.
+	 * The caller must hold the trace_mutex. */
+	void finish()
+	{
+		if (trace_local.generation == trace_generation && trace_on.load())
+			flush();
+	}
+
+	~thread_trace_t()
+	{
+		auto lock = std::lock_guard{trace_mutex};
+		finish();
+		trace_local = {};
+	}
+};
+
+static thread_local auto thread_trace = thread_trace_t{};
+
+void trace_reserve(size_t size)
+{
+	auto lock = std::lock_guard{trace_mutex};
+	auto& local = thread_trace;
+	if (trace_local.generation != trace_generation) {  // first record in this recording
+		trace_local.generation = trace_generation;
+		local.thread = trace_threads++;
+	} else {
+		local.flush();
+	}
+	size = std::max(size, trace_chunk_size);
+	if (local.capacity < size) {
+		local.data = std::make_unique<char[]>(size);
+		local.capacity = size;
+	}
+	trace_local.pos = local.data.get();
+	trace_local.end = local.data.get() + local.capacity;
+}
+
+static FILE* open_trace_file(const char* path)
+{
+#ifdef __STDC_LIB_EXT1__
+	FILE* file = nullptr;
+	if (fopen_s(&file, path, "wb") != 0)
+		file = nullptr;
+	return file;
+#else
+	return std::fopen(path, "wb");
+#endif
+}
+
+C_PUBLIC int table_trace_start(const char* trace_path)
+{
+	log_err("table_trace_start(%s)", trace_path);
+	table_trace_stop();
+	auto lock = std::lock_guard{trace_mutex};
+	trace_file = open_trace_file(trace_path);
+	if (trace_file == nullptr) {
+		log_err("failed to open trace file: %s", trace_path);
+		return -1;
+	}
+	trace_epoch = trace_clock::now();
+	trace_epoch_ticks = trace_ticks();
+#ifdef TRACE_TSC
+	// preliminary calibration in case the recording is not stopped, refined in table_trace_stop
+	while (trace_clock::now() - trace_epoch < std::chrono::milliseconds{1})
+		;
+#endif
+	const auto tick_ns = trace_tick_ns();
+	std::fwrite(trace_magic.data(), 1, trace_magic.size(), trace_file);
+	std::fwrite(&tick_ns, sizeof(tick_ns), 1, trace_file);
+	std::fwrite(&trace_epoch_ticks, sizeof(trace_epoch_ticks), 1, trace_file);
+	++trace_generation;
+	trace_threads = 0;
+	trace_on.store(true);
+	return 0;
+}
+
+/** Flushes the calling thread's buffer: buffers of other threads are flushed when they are full
+ * or when those threads exit, thus stop the recording after the worker threads are done. */
+C_PUBLIC int table_trace_stop()
+{
+	log_err("table_trace_stop()");
+	auto lock = std::lock_guard{trace_mutex};
+	if (!trace_on.load())
+		return 0;
+	thread_trace.finish();
+	trace_on.store(false);
+	const auto tick_ns = trace_tick_ns();
+	if (std::fseek(trace_file, static_cast<long>(trace_magic.size()), SEEK_SET) == 0)
+		std::fwrite(&tick_ns, sizeof(tick_ns), 1, trace_file);
+	std::fclose(trace_file);
+	trace_file = nullptr;
+	return 0;
+}
+
+/** Starts the recording when the library is loaded if LIBTABLE_TRACE names the trace file,
+ * and stops it when the library is unloaded. */
+static struct trace_session_t
+{
+	trace_session_t()
+	{
+#ifdef __STDC_LIB_EXT1__
+		auto len = size_t{};
+		auto path = std::string(1024, '\0');
+		if (getenv_s(&len, path.data(), path.size(), "LIBTABLE_TRACE") == 0 && len > 1) {
+			path.resize(len - 1);  // len includes the terminating zero
+			table_trace_start(path.c_str());
+		}
+#else
+		if (const auto* path = std::getenv("LIBTABLE_TRACE"); path != nullptr && *path != '\0')
+			table_trace_start(path);
+#endif
+	}
+	~trace_session_t() { table_trace_stop(); }
+} trace_session;
@@ -0,0 +1,266 @@
+/**
+ * Binary trace of library calls: the format shared by the recorder and the replayer.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ *
+ * The trace starts with trace_magic, the nanoseconds per tick (double) and the 64-bit tick count
+ * at the start of recording, followed by chunks of records, where each chunk is
+ * a 32-bit thread number, a 32-bit payload size and the payload of records from that thread.
+ * Each record is an 8-bit op_t, 64-bit start tick count and duration in ticks,
+ * followed by the arguments and the result of the call.
+ * Integers and doubles are stored in native byte order, strings and arrays are prefixed by
+ * a 32-bit length, output arrays are stored after the inputs instead of their pointers.
+ */
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include "dynlib.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>	// memcpy, strlen
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TRACE_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>	 // __rdtsc
+#else
+#include <x86intrin.h>	// __rdtsc
+#endif
+#endif
+
+/** Traced functions with their C signatures (the signature is variadic as it contains commas).
+ * New entries must be appended at the end to keep the recorded op codes. */
+#define TABLE_TRACE_OPS(X)                                                                \
+	X(table_new_int, int(int, int, int))                                                  \
+	X(table_new_double, int(int, int, double))                                            \
+	X(table_resize_double, int(int, int, int, double))                                    \
+	X(table_resize_int, int(int, int, int, int))                                          \
+	X(table_read_csv, int(const char*, int))                                              \
+	X(table_write_csv, int(int, const char*))                                             \
+	X(table_copy, int(int))                                                               \
+	X(table_clear, int(int))                                                              \
+	X(table_rows, int(int))                                                               \
+	X(table_cols, int(int))                                                               \
+	X(read_int, int(int, int, int))                                                       \
+	X(read_double, double(int, int, int))                                                 \
+	X(write_int, void(int, int, int, int))                                                \
+	X(write_double, void(int, int, int, double))                                          \
+	X(interpolate, double(int, double, int, int))                                         \
+	X(read_int_col, void(int, int, int, int*, int, int))                                  \
+	X(read_int_row, void(int, int, int, int*, int, int))                                  \
+	X(table_last_error, int())                                                            \
+	X(table_error_count, int())                                                           \
+	X(table_checkpoint, int(int))                                                         \
+	X(table_rollback, int(int, int))                                                      \
+	X(table_release, int(int, int))                                                       \
+	X(table_sampler_build, int(int, int, int))                                            \
+	X(table_sample, double(int, double, double))                                          \
+	X(table_sample_continuous, double(int, double))                                       \
+	X(table_new_sparse_int, int(int, int, int))                                           \
+	X(table_new_sparse_double, int(int, int, double))                                     \
+	X(table_is_sparse, int(int))                                                          \
+	X(table_read_csv_async, int(const char*, int))                                        \
+	X(table_ready, int(int))                                                              \
+	X(table_matvec, int(int, const double*, int, double*, int))                           \
+	X(table_mlp_eval, int(const int*, const int*, int, const double*, int, double*, int)) \
+	X(table_memory_bytes, double(int))                                                    \
+	X(table_memory_total, double())                                                       \
+	X(table_set_memory_limit, int(double))
+
+enum class op_t : std::uint8_t {
+	none,
+#define TABLE_TRACE_ENUM(name, ...) name,
+	TABLE_TRACE_OPS(TABLE_TRACE_ENUM)
+#undef TABLE_TRACE_ENUM
+		count
+};
+
+constexpr auto trace_magic = std::string_view{"UTBTRC03"};
+
+using trace_clock = std::chrono::steady_clock;
+
+/** Returns the time stamp of a call: the CPU time stamp counter where available as it is several
+ * times cheaper than reading the clock, otherwise the clock in nanoseconds. */
+inline std::int64_t trace_ticks()
+{
+#ifdef TRACE_TSC
+	return static_cast<std::int64_t>(__rdtsc());
+#else
+	const auto now = trace_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+#endif
+}
+
+/** Turns the recording on: returns 0 on success, -1 if the file cannot be opened */
+C_PUBLIC int table_trace_start(const char* trace_path);
+/** Flushes the buffered records and turns the recording off, returns 0 */
+C_PUBLIC int table_trace_stop();
+
+extern std::atomic<bool> trace_on;
+extern std::atomic<unsigned> trace_generation;	// incremented on every start
+
+/** Free space of the per-thread buffer of records */
+struct trace_buffer_t
+{
+	char* pos = nullptr;	 // the next record goes here
+	char* end = nullptr;	 // the end of the buffer
+	unsigned generation = 0;  // the recording the buffer belongs to
+};
+
+#if defined(__GNUC__) && !defined(_WIN32)
+// a few bytes of static TLS avoid the __tls_get_addr call on every record in the shared library
+#define TRACE_TLS __attribute__((tls_model("initial-exec")))
+#else
+#define TRACE_TLS
+#endif
+
+extern thread_local constinit trace_buffer_t trace_local TRACE_TLS;
+
+/** Makes room for size bytes in the calling thread's buffer by writing out the full buffer,
+ * or by starting the thread's part of a new recording */
+void trace_reserve(size_t size);
+
+template <typename T>
+constexpr size_t trace_size(const T&)
+{
+	return sizeof(T);
+}
+
+inline size_t trace_size(const char* text)
+{
+	return sizeof(std::uint32_t) + (text ? std::strlen(text) : 0);
+}
+
+template <typename T>
+size_t trace_size(std::span<T> items)
+{
+	return sizeof(std::uint32_t) + items.size_bytes();
+}
+
+template <typename T>
+char* trace_put(char* pos, const T& value)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	std::memcpy(pos, &value, sizeof(T));
+	return pos + sizeof(T);
+}
+
+inline char* trace_put(char* pos, const char* text)
+{
+	const auto len = static_cast<std::uint32_t>(text ? std::strlen(text) : 0);
+	pos = trace_put(pos, len);
+	if (len > 0)
+		std::memcpy(pos, text, len);
+	return pos + len;
+}
+
+template <typename T>
+char* trace_put(char* pos, std::span<T> items)
+{
+	pos = trace_put(pos, static_cast<std::uint32_t>(items.size()));
+	if (!items.empty())
+		std::memcpy(pos, items.data(), items.size_bytes());
+	return pos + items.size_bytes();
+}
+
+/** Appends the record of the call which started at the given tick count.
+ * The size of scalar records is a compile-time constant, thus the record is copied into the
+ * buffer after a single check for space. */
+template <typename... Values>
+void trace_record(op_t op, std::int64_t start, const Values&... values)
+{
+	const auto duration = trace_ticks() - start;
+	const auto size =
+		sizeof(op) + sizeof(start) + sizeof(duration) + (trace_size(values) + ... + 0);
+	auto& local = trace_local;
+	if (local.generation != trace_generation.load(std::memory_order_relaxed) ||
+		static_cast<size_t>(local.end - local.pos) < size) [[unlikely]]
+		trace_reserve(size);
+	auto* pos = trace_put(local.pos, op);
+	pos = trace_put(pos, start);
+	pos = trace_put(pos, duration);
+	((pos = trace_put(pos, values)), ...);
+	local.pos = pos;
+}
+
+/** Calls the function and records its arguments and result if the recording is on */
+template <typename Fn, typename... Args>
+auto traced(op_t op, Fn fn, Args... args)
+{
+	if (!trace_on.load(std::memory_order_relaxed)) [[likely]]
+		return fn(args...);
+	const auto start = trace_ticks();
+	if constexpr (std::is_void_v<decltype(fn(args...))>) {
+		fn(args...);
+		trace_record(op, start, args...);
+	} else {
+		const auto res = fn(args...);
+		trace_record(op, start, args..., res);
+		return res;
+	}
+}
+
+/** Reads the values of the records */
+class trace_reader_t
+{
+	const char* pos;
+	const char* end;
+
+public:
+	trace_reader_t(const char* begin, const char* end): pos{begin}, end{end} {}
+	bool empty() const { return pos == end; }
+
+	template <typename T>
+	bool get(T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		if (static_cast<size_t>(end - pos) < sizeof(T))
+			return false;
+		std::memcpy(&value, pos, sizeof(T));
+		pos += sizeof(T);
+		return true;
+	}
+
+	/** Returns a view of the next size bytes */
+	bool get(const char*& data, size_t size)
+	{
+		if (static_cast<size_t>(end - pos) < size)
+			return false;
+		data = pos;
+		pos += size;
+		return true;
+	}
+
+	/** Reads a length-prefixed array of items */
+	template <typename T>
+	bool get(std::vector<T>& items)
+	{
+		auto len = std::uint32_t{};
+		if (!get(len) || static_cast<size_t>(end - pos) < len * sizeof(T))
+			return false;
+		items.resize(len);
+		if (len > 0)
+			std::memcpy(items.data(), pos, len * sizeof(T));
+		pos += len * sizeof(T);
+		return true;
+	}
+
+	/** Reads a length-prefixed string */
+	bool get(std::string& text)
+	{
+		auto len = std::uint32_t{};
+		if (!get(len) || static_cast<size_t>(end - pos) < len)
+			return false;
+		text.assign(pos, len);
+		pos += len;
+		return true;
+	}
+};
+
+#endif /* _TRACE_HPP_ */
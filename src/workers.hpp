@@ -0,0 +1,89 @@
+/**
+ * Pool of worker threads running background jobs.
+ * Author: Marius Mikucionis <marius@cs.aau.dk>
+ */
+#ifndef _WORKERS_HPP_
+#define _WORKERS_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>  // make_shared
+#include <mutex>
+#include <thread>
+#include <type_traits>	// invoke_result_t
+#include <vector>
+
+/** Fixed-size pool of threads taking jobs from a shared queue.
+ * Threads are started on demand (up to the limit), so an unused pool costs nothing.
+ * The destructor finishes the queued jobs before joining the threads. */
+class worker_pool_t
+{
+	std::mutex mutex;  // guards the variables below
+	std::condition_variable wakeup;
+	std::deque<std::function<void()>> jobs;
+	std::vector<std::thread> threads;
+	size_t idle = 0;  // the number of threads waiting for jobs (or starting to)
+	bool stopping = false;
+	const size_t limit;
+
+public:
+	/** Creates a pool of at most the given number of threads (one per core by default) */
+	explicit worker_pool_t(size_t limit = std::max(std::thread::hardware_concurrency(), 1u)):
+		limit{limit}
+	{}
+	worker_pool_t(const worker_pool_t&) = delete;
+	worker_pool_t& operator=(const worker_pool_t&) = delete;
+	~worker_pool_t()
+	{
+		{
+			auto lock = std::lock_guard{mutex};
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	/** Queues the job and returns the future of its result (or its exception) */
+	template <typename Fn>
+	std::future<std::invoke_result_t<Fn>> submit(Fn fn)
+	{
+		using result_t = std::invoke_result_t<Fn>;
+		// std::function requires copyable callables, hence the shared task
+		auto task = std::make_shared<std::packaged_task<result_t()>>(std::move(fn));
+		auto result = task->get_future();
+		{
+			auto lock = std::lock_guard{mutex};
+			jobs.emplace_back([task] { (*task)(); });
+			// each idle thread takes one of the queued jobs, start another thread for the rest
+			if (jobs.size() > idle && threads.size() < limit) {
+				threads.emplace_back([this] { work(); });
+				++idle;	 // the thread waits for the mutex, hence it is counted as idle already
+			}
+		}
+		wakeup.notify_one();
+		return result;
+	}
+
+private:
+	void work()
+	{
+		auto lock = std::unique_lock{mutex};
+		while (true) {
+			wakeup.wait(lock, [this] { return stopping || !jobs.empty(); });
+			--idle;
+			if (jobs.empty())
+				return;	 // stopping and nothing left to do
+			auto job = std::move(jobs.front());
+			jobs.pop_front();
+			lock.unlock();
+			job();
+			lock.lock();
+			++idle;
+		}
+	}
+};
+
+#endif /* _WORKERS_HPP_ */